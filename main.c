@@ -1,77 +1,384 @@
 /* ***** ***** */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "src/lambda_parser.h"
+#include "src/normalize.h"
+#include "src/server.h"
+#include "src/stats.h"
+#include "src/gmachine.h"
+#include "src/combinators.h"
+#include "src/profile.h"
+
+/* ***** ***** */
+
+#define IOBUF_SIZE (1 << 16)
+#define NFCACHE_CAP (64 << 20)
+#define HEAP_BLOCK (4 << 20)
+#define PROFILE_TOP 20
+
+struct options {
+    int normalize;  // `-n`: print normal forms instead of parsed terms.
+    int named;      // `-l`: print with names rather than de Bruijn indexes.
+    int quiet;      // `-q`: print nothing but the throughput reports.
+    int defs;       // `-d`: keep references to declarations by name.
+    int simplify;   // `-O`: partially evaluate declarations when parsed.
+    int lazy;       // `--lazy`: parse only the declarations used.
+    int gc;         // `-g`: allocate terms in a garbage collected heap.
+    int stats;      // `--stats`: print the statistics of each term.
+    int shared;     // `--shared`: print shared subterms as declarations.
+    int gmachine;   // `--gmachine`: normalize by graph reduction.
+    int ski;        // `--ski`: normalize by combinator reduction.
+    char *profile;  // `--profile OUT`: profile reductions, into OUT.
+    char *serve;    // `-s SOCKET`: serve requests against the FILEs.
+    char *client;   // `-c SOCKET`: send the FILEs as requests.
+};
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n] [-l] [-q] [-d] [-O] [-g]"
+                    " [--stats] [--shared] [--lazy]\n"
+                    "       [--gmachine] [--ski] [--profile OUT]"
+                    " [-s SOCKET | -c SOCKET] [FILE...]\n"
+                    "  Reads declarations from the FILEs (or `-`, or stdin"
+                    " if none) in order,\n"
+                    "  sharing definitions between them, and prints each"
+                    " term.\n"
+                    "  -n  print normal forms\n"
+                    "  -l  print with named variables\n"
+                    "  -q  print only the per-file throughput\n"
+                    "  -d  print references to declared names as such,"
+                    " rather than inlined\n"
+                    "  -O  simplify each `@` declaration (bounded beta-eta"
+                    " reduction) when read\n"
+                    "  -g  use a garbage collected heap rather than"
+                    " reference counting\n"
+                    "  --stats  print the size, depth and sharing of each"
+                    " term\n"
+                    "  --shared  print repeated closed subterms once, as"
+                    " declarations `@ _N_K = ...`\n"
+                    "  --lazy  only index `@` declarations, parsing those"
+                    " that the other terms\n"
+                    "          refer to when needed, and print the other"
+                    " terms only\n"
+                    "  --gmachine  print normal forms, computed by lazy"
+                    " graph reduction of\n"
+                    "              lambda lifted terms (not with -g)\n"
+                    "  --ski  print normal forms, up to eta, computed by"
+                    " graph reduction of\n"
+                    "         combinators compiled by bracket abstraction\n"
+                    "  --profile  print normal forms, and write the reduction"
+                    " steps of each call\n"
+                    "             path of declarations to OUT as folded"
+                    " stacks (not with\n"
+                    "             --gmachine or --ski)\n"
+                    "  -s  load the FILEs, then serve requests on SOCKET\n"
+                    "  -c  send each FILE as a request to the server on"
+                    " SOCKET\n", prog);
+}
+
+/* ***** ***** */
+
+//  Handles all declarations of `src`, a window at a time as they are
+//  read (see `next_sources`), so that each is printed once it is
+//  complete. The name stack and the context are reused across
+//  declarations (and files), so the loop itself does no setup. `seen`
+//  counts the declarations of the earlier files, so that the prefixes
+//  of `--shared` are unique across files. Returns the number of
+//  declarations, or `-1` on error.
+static long run_batch(struct sources *src, long seen, struct names *xs
+                                          , struct contexts2 *ctx
+                                          , struct nfcaches *nfc
+                                          , struct gmachines *gm
+                                          , struct combinators *cm
+                                          , struct heaps *heap
+                                          , struct options *opts)
+{
+    long n = 0;
+    int more = 1;
+    while (!parse_eof(src) || (more = next_sources(src, ctx)) > 0) {
+        if (opts->lazy) {
+            if (index_declterms2(src, ctx) < 0) {return -1;}
+            if (parse_eof(src)) {continue;}
+        }
+        struct terms2 *t = parse_declterms2(src, xs, ctx);
+        if (!t) {clear_names(xs); return -1;}
+        if (nfc || gm || cm) {
+            struct terms2 *nf = gm ? normalize_gmachines(gm, t)
+                              : cm ? normalize_combinators(cm, t)
+                                   : normalize_terms2(t, nfc);
+            decref_terms2(t);
+            if (!nf) {clear_names(xs); return -1;}
+            t = compact_terms2(nf);
+            decref_terms2(nf);
+        }
+        if (!opts->quiet) {
+            if (opts->shared) {
+                char prefix[32];
+                snprintf(prefix, sizeof(prefix), "_%ld_", seen + n);
+                fprintf_shared_terms2(stdout, t, prefix);
+            } else if (opts->named) {
+                fprintf_named_terms2(stdout, t, xs);
+            } else {
+                fprintf_terms2(stdout, t);
+            }
+            putc_unlocked('\n', stdout);
+        }
+        struct termstats st;
+        if (opts->stats && !stats_terms2(t, &st)) {
+            fprintf(stdout, "%ld: ", n);
+            fprintf_termstats(stdout, st);
+            putc_unlocked('\n', stdout);
+        }
+        clear_names(xs);
+        decref_terms2(t);
+        // Between declarations, all that lives is in `ctx` and `nfc`.
+        if (heap) {maybe_collect_heaps(heap);}
+        n++;
+        // The window is done, and reading the next may block.
+        if (parse_eof(src)) {fflush(stdout);}
+    }
+    return more < 0 ? -1 : n;
+}
+
+static int run_file(char *path, long *seen, struct names *xs
+                              , struct contexts2 *ctx
+                              , struct nfcaches *nfc
+                              , struct gmachines *gm
+                              , struct combinators *cm
+                              , struct heaps *heap
+                              , struct options *opts)
+{
+    int is_stdin = !strcmp(path, "-");
+    FILE *fp = is_stdin ? stdin : fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error reading file %s.\n", path);
+        return 0;
+    }
+    double t0 = seconds();
+    struct sources *src = open_sources(fp);
+    long n = src ? run_batch(src, *seen, xs, ctx, nfc, gm, cm, heap, opts)
+                 : -1;
+    double dt = seconds() - t0;
+    size_t bytes = src ? size_sources(src) : 0;
+    // The declarations are kept for the next files.
+    detach_contexts2(ctx);
+    free_sources(src);
+    if (!is_stdin) {fclose(fp);}
+    if (!src) {return 0;}
+    if (n < 0) {
+        fprintf(stderr, "%s: parse error.\n", path);
+        return 0;
+    }
+    *seen += n;
+    fflush(stdout);
+    fprintf(stderr, "%s: %ld terms in %.3f s (%.0f terms/s"
+                  , path, n, dt, dt > 0 ? n / dt : 0.0);
+    fprintf(stderr, ", %.1f MB/s).\n", dt > 0 ? bytes / dt / 1e6 : 0.0);
+    return 1;
+}
+
+/* ***** ***** */
+
+//  Client mode.
+
+static char *slurp(FILE *fp, size_t *len)
+{
+    size_t cap = 1 << 12, n;
+    char *buf = malloc(cap);
+    *len = 0;
+    while (buf && (n = fread(buf + *len, 1, cap - *len, fp)) > 0) {
+        *len += n;
+        if (*len == cap) {
+            char *tmp = realloc(buf, cap *= 2);
+            if (!tmp) {free(buf);}
+            buf = tmp;
+        }
+    }
+    return buf;
+}
+
+static int run_request(char *path, int fd, struct options *opts)
+{
+    int is_stdin = !strcmp(path, "-");
+    FILE *fp = is_stdin ? stdin : fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error reading file %s.\n", path);
+        return 0;
+    }
+    size_t len, rlen;
+    char *buf = slurp(fp, &len);
+    if (!is_stdin) {fclose(fp);}
+    if (!buf) {return 0;}
+    unsigned int flags = (opts->normalize ? REQ_NORMALIZE : 0)
+                       | (opts->named ? REQ_NAMED : 0);
+    char *reply;
+    double t0 = seconds();
+    int status = request_servers(fd, flags, buf, len, &reply, &rlen);
+    double dt = seconds() - t0;
+    free(buf);
+    if (status < 0) {
+        fprintf(stderr, "%s: connection failed.\n", path);
+        return 0;
+    }
+    if (status == 0) {
+        fprintf(stderr, "%s: %s", path, reply);
+    } else if (!opts->quiet) {
+        fwrite(reply, 1, rlen, stdout);
+    }
+    free(reply);
+    fflush(stdout);
+    fprintf(stderr, "%s: answered in %.3f ms.\n", path, dt * 1e3);
+    return status;
+}
+
+static int run_client(int argc, char *argv[], int i, struct options *opts)
+{
+    int fd = connect_servers(opts->client);
+    if (fd < 0) {return 1;}
+    int ok = 1;
+    if (i == argc) {
+        ok = run_request("-", fd, opts);
+    }
+    for (; i < argc && ok; i++) {
+        ok = run_request(argv[i], fd, opts);
+    }
+    close(fd);
+    return ok ? 0 : 1;
+}
 
 /* ***** ***** */
 
 int main(int argc, char *argv[])
 {
-    if (argc < 2) {
-        return 1;
-    } else {
-        FILE *fp = fopen(argv[1], "r");
-        if (fp) {
-            // Works! 
-            //struct names *xs = alloc_names(64);
-            //struct terms1 *t1 = parse_terms1(fp);
-            //struct terms2 *t2 = lam2db(t1, xs);
-            //free_terms1(t1);
-            //free_terms2(t2);
-            //free_names(xs);
-            
-            // Works!
-            //struct names *xs = alloc_names(16);
-
-            //struct terms2 *t2 = parse_terms2(fp, xs);
-            //fprintf_terms2(stdout, t2); printf("\n"); 
-            //struct terms1 *t1 = db2lam(t2, xs);
-            //fprintf_terms1(stdout, t1); printf("\n"); 
-            //free_terms2(t2);
-            //free_terms1(t1);
-
-            //struct terms2 *e2 = parse_terms2(fp, xs);
-            //fprintf_terms2(stdout, e2); printf("\n"); 
-            //struct terms1 *e1 = db2lam(e2, xs);
-            //fprintf_terms1(stdout, e1); printf("\n"); 
-            //free_terms2(e2);
-            //free_terms1(e1);
-
-            //free_names(xs);
-            
-            // Works!
-            //struct contexts1 *ctx = alloc_contexts1(16);
-            //struct terms1 *t0 = parse_declterms1(fp, ctx);
-            //fprintf_terms1(stdout, t0); printf("\n");
-            //struct terms1 *t1 = parse_declterms1(fp, ctx);
-            //fprintf_terms1(stdout, t1); printf("\n");
-            //struct terms1 *t2 = parse_declterms1(fp, ctx);
-            //fprintf_terms1(stdout, t2); printf("\n");
-            //struct names *xs = alloc_names(16);
-            //struct terms2 *t3 = lam2db(t2, xs);
-            //fprintf_terms2(stdout, t3); printf("\n");
-            //decref_terms2(t3);
-            //free_names(xs);
-            //free_contexts1(ctx);
-
-            // Works!
-            struct names *xs = alloc_names(16);
-            struct contexts2 *ctx = alloc_contexts2(16);
-            struct terms2 *t0 = parse_declterms2(fp, xs, ctx);
-            fprintf_terms2(stdout, t0); printf("\n");
-            struct terms2 *t1 = parse_declterms2(fp, xs, ctx);
-            fprintf_terms2(stdout, t1); printf("\n");
-            struct terms2 *t2 = parse_declterms2(fp, xs, ctx);
-            fprintf_terms2(stdout, t2); printf("\n");
-            free_contexts2(ctx);
-            free_names(xs);
-
-            fclose(fp);
+    struct options opts = {0};
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (!strcmp(argv[i], "-n")) {
+            opts.normalize = 1;
+        } else if (!strcmp(argv[i], "-l")) {
+            opts.named = 1;
+        } else if (!strcmp(argv[i], "-q")) {
+            opts.quiet = 1;
+        } else if (!strcmp(argv[i], "-d")) {
+            opts.defs = 1;
+        } else if (!strcmp(argv[i], "-O")) {
+            opts.simplify = 1;
+        } else if (!strcmp(argv[i], "-g")) {
+            opts.gc = 1;
+        } else if (!strcmp(argv[i], "--stats")) {
+            opts.stats = 1;
+        } else if (!strcmp(argv[i], "--shared")) {
+            opts.shared = 1;
+        } else if (!strcmp(argv[i], "--lazy")) {
+            opts.lazy = 1;
+        } else if (!strcmp(argv[i], "--gmachine")) {
+            opts.gmachine = 1;
+        } else if (!strcmp(argv[i], "--ski")) {
+            opts.ski = 1;
+        } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            opts.profile = argv[++i];
+            opts.normalize = 1;
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            opts.serve = argv[++i];
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            opts.client = argv[++i];
         } else {
-            fprintf(stderr, "Error reading file.\n");
+            usage(argv[0]);
             return 1;
         }
     }
-    return 0;
-}
+    static char outbuf[IOBUF_SIZE];
+    setvbuf(stdout, outbuf, _IOFBF, IOBUF_SIZE);
+    if (opts.client) {return run_client(argc, argv, i, &opts);}
+    if (opts.serve) {
+        // The preludes are only loaded, into a heap that is never
+        // collected: the workers share their terms, and so must not
+        // parse declarations on demand.
+        opts.normalize = 0;
+        opts.lazy = 0;
+        opts.gmachine = 0;
+        opts.ski = 0;
+        opts.profile = NULL;
+        opts.quiet = 1;
+        opts.gc = 1;
+    }
+    if (opts.gmachine && (opts.gc || opts.profile)) {
+        // The machine keeps pointers to the terms of the context, and
+        // does not reduce `terms2`.
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.ski && (opts.gmachine || opts.profile)) {
+        usage(argv[0]);
+        return 1;
+    }
 
+    struct names *xs = alloc_names(64);
+    struct contexts2 *ctx = alloc_contexts2(64);
+    set_flags_contexts2(ctx, (opts.defs ? CTX2_DEFS : 0)
+                           | (opts.simplify ? CTX2_SIMPLIFY : 0));
+    struct nfcaches *nfc = opts.normalize && !opts.gmachine && !opts.ski
+                         ? alloc_nfcaches(NFCACHE_CAP) : NULL;
+    struct gmachines *gm = opts.gmachine ? alloc_gmachines(ctx) : NULL;
+    struct combinators *cm = opts.ski ? alloc_combinators() : NULL;
+    struct profiles *prof = opts.profile ? alloc_profiles(ctx) : NULL;
+    use_profiles(prof);
+    struct heaps *heap = NULL;
+    if (opts.gc) {
+        heap = alloc_heaps(HEAP_BLOCK);
+        add_scanner_heaps(heap, scan_contexts2, ctx);
+        if (nfc) {add_scanner_heaps(heap, scan_nfcaches, nfc);}
+        use_heaps(heap);
+    }
+    int ok = 1;
+    long seen = 0;
+    if (i == argc && !opts.serve) {
+        ok = run_file("-", &seen, xs, ctx, nfc, gm, cm, heap, &opts);
+    }
+    for (; i < argc && ok; i++) {
+        ok = run_file(argv[i], &seen, xs, ctx, nfc, gm, cm, heap, &opts);
+    }
+    if (ok && opts.serve) {
+        use_heaps(NULL);
+        long nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+        ok = serve_contexts2(opts.serve, ctx, nworkers > 0 ? nworkers : 1);
+    }
+    fflush(stdout);
+    use_profiles(NULL);
+    if (prof) {
+        FILE *out = fopen(opts.profile, "w");
+        if (out) {
+            fprintf_folded_profiles(out, prof);
+            fclose(out);
+        } else {
+            fprintf(stderr, "Error writing file %s.\n", opts.profile);
+            ok = 0;
+        }
+        fprintf_top_profiles(stderr, prof, PROFILE_TOP);
+    }
+    if (heap) {
+        struct heapstats hs = stats_heaps(heap);
+        fprintf(stderr, "heap: %zu collections, %.1f MB copied"
+                      , hs.collections, hs.copied / 1e6);
+        fprintf(stderr, ", %.1f MB live.\n", hs.live / 1e6);
+    }
+    free_nfcaches(nfc);
+    free_gmachines(gm);
+    free_combinators(cm);
+    free_profiles(prof);
+    free_contexts2(ctx);
+    free_heaps(heap);
+    free_names(xs);
+    return ok ? 0 : 1;
+}
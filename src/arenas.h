@@ -0,0 +1,81 @@
+/**
+ *          ╔════════╗
+ *          ║ ARENAS ║
+ *          ╚════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Bump allocation of the nodes of the graph reducers, which
+ *          are freed all at once after each normalization. Not part of
+ *          the public interface.
+ */
+
+/* ***** ***** */
+
+#ifndef ARENAS_H
+#define ARENAS_H
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#include "basics.h"
+
+/* ***** ***** */
+
+//  Arenas: lists of chunks, newest first, freed or cleared as a whole.
+
+#define ARENA_CHUNK (1 << 20)
+
+struct chunks {
+    struct chunks *next;
+    size_t size;
+    size_t used;
+    char mem[];
+};
+
+struct arenas {
+    struct chunks *first;
+};
+
+static inline void *bump_arenas(struct arenas *a, size_t size)
+{
+    size = (size + 7) & ~(size_t) 7;
+    struct chunks *c = a->first;
+    if (!c || c->size - c->used < size) {
+        size_t cs = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        c = malloc(sizeof(struct chunks) + cs);
+        MALCHECK(c);
+        *c = (struct chunks) {.next = a->first, .size = cs, .used = 0};
+        a->first = c;
+    }
+    void *p = c->mem + c->used;
+    c->used += size;
+    return p;
+}
+
+static inline void free_arenas(struct arenas *a)
+{
+    while (a->first) {
+        struct chunks *next = a->first->next;
+        free(a->first);
+        a->first = next;
+    }
+}
+
+//  Frees all but one chunk, for reuse.
+static inline void clear_arenas(struct arenas *a)
+{
+    if (!a->first) {return;}
+    struct chunks *keep = a->first;
+    a->first = keep->next;
+    free_arenas(a);
+    keep->next = NULL;
+    keep->used = 0;
+    a->first = keep;
+}
+
+/* ***** ***** */
+
+#endif // ARENAS_H
@@ -0,0 +1,590 @@
+/*
+    ╔═════════════╗
+    ║ COMBINATORS ║
+    ╚═════════════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "lambda_terms.h"
+#include "normalize.h"
+#include "arenas.h"
+#include "combinators.h"
+
+/* ***** ***** */
+
+//  Graph nodes, which are also the code compiled to. `CN_VAR` are the
+//  variables bound by the lambdas being compiled, and those that read-
+//  back applies functions to, identified by their de Bruijn level; free
+//  variables of the term being normalized have negative levels.
+//
+//  While compiling, `max` is the largest level of a variable in the
+//  node, `NO_LEVEL` if there is none, and `abs` the node with that
+//  variable abstracted, once computed.
+
+#define NO_LEVEL LONG_MIN
+
+enum {CI, CK, CS, CB, CC, CS1, CB1, CC1, NCOMBS};
+
+static const unsigned int arities[NCOMBS] = {1, 2, 3, 3, 3, 4, 4, 4};
+static const char *const names[NCOMBS] = { "I", "K", "S", "B", "C"
+                                         , "S'", "B*", "C'" };
+
+struct cnodes {
+    enum {CN_AP, CN_COMB, CN_NUM, CN_VAR, CN_IND} tag;
+    union {
+        struct {struct cnodes *fun; struct cnodes *arg;} ap;
+        unsigned int comb;
+        unsigned long num;
+        long lvl;
+        struct cnodes *ind;
+    };
+    long max;
+    struct cnodes *abs;
+};
+
+//  Compiled shared subterms, by pointer and depth. Closed ones are
+//  reused at any depth.
+
+struct cmemos {
+    const void *key;
+    unsigned int depth;
+    struct cnodes *code;
+};
+
+struct combinators {
+    struct arenas mem;
+    struct cnodes combs[NCOMBS];
+    size_t nmemo;
+    size_t capmemo;         // A power of two, or zero.
+    struct cmemos *memo;
+    size_t sp;
+    size_t capstack;
+    struct cnodes **stack;
+    size_t nkonts;
+    size_t capkonts;
+    struct terms2 **konts;  // Pending read-backs, see `readback_cnodes`.
+};
+
+struct combinators *alloc_combinators(void)
+{
+    struct combinators *cm = calloc(1, sizeof(struct combinators));
+    MALCHECK(cm);
+    for (unsigned int c = 0; c < NCOMBS; c++) {
+        cm->combs[c] = (struct cnodes) { .tag = CN_COMB, .comb = c
+                                       , .max = NO_LEVEL };
+    }
+    return cm;
+}
+
+void free_combinators(struct combinators *cm)
+{
+    if (!cm) {return;}
+    free_arenas(&cm->mem);
+    free(cm->memo);
+    free(cm->stack);
+    free(cm->konts);
+    free(cm);
+}
+
+/* ***** ***** */
+
+//  Constructors.
+
+static struct cnodes *mk_cnodes(struct combinators *cm, struct cnodes n)
+{
+    struct cnodes *g = bump_arenas(&cm->mem, sizeof(struct cnodes));
+    if (g) {*g = n;}
+    return g;
+}
+
+static struct cnodes *mk_ap_cnodes( struct combinators *cm
+                                  , struct cnodes *fun, struct cnodes *arg)
+{
+    if (!fun || !arg) {return NULL;}
+    return mk_cnodes(cm, (struct cnodes) {
+        .tag = CN_AP, .ap = {fun, arg}
+      , .max = fun->max > arg->max ? fun->max : arg->max});
+}
+
+static struct cnodes *mk_var_cnodes(struct combinators *cm, long lvl)
+{
+    return mk_cnodes(cm, (struct cnodes) { .tag = CN_VAR, .lvl = lvl
+                                         , .max = lvl });
+}
+
+static struct cnodes *mk_num_cnodes(struct combinators *cm, unsigned long n)
+{
+    return mk_cnodes(cm, (struct cnodes) { .tag = CN_NUM, .num = n
+                                         , .max = NO_LEVEL });
+}
+
+//  The combinator `c` applied to `x`, `y` and, unless `NULL`, `z`.
+static struct cnodes *mk_comb_cnodes( struct combinators *cm, unsigned int c
+                                    , struct cnodes *x, struct cnodes *y
+                                    , struct cnodes *z)
+{
+    struct cnodes *e = mk_ap_cnodes(cm, &cm->combs[c], x);
+    e = mk_ap_cnodes(cm, e, y);
+    return z ? mk_ap_cnodes(cm, e, z) : e;
+}
+
+/* ***** ***** */
+
+//  The table of compiled shared subterms.
+
+static size_t hash_cmemos(const void *p, unsigned int depth, size_t cap)
+{
+    uint64_t h = ((uint64_t) (uintptr_t) p >> 3) + depth;
+    h *= 0x9e3779b97f4a7c15ull;
+    return (size_t) (h >> 32) & (cap - 1);
+}
+
+static struct cnodes *get_cmemos( struct combinators *cm, const void *key
+                                , unsigned int depth)
+{
+    if (!cm->capmemo) {return NULL;}
+    size_t i = hash_cmemos(key, depth, cm->capmemo);
+    for (; cm->memo[i].key; i = (i + 1) & (cm->capmemo - 1)) {
+        struct cmemos *m = &cm->memo[i];
+        if (m->key == key && (m->depth == depth || m->code->max < 0)) {
+            return m->code;
+        }
+    }
+    return NULL;
+}
+
+static void put_cmemos( struct combinators *cm, const void *key
+                      , unsigned int depth, struct cnodes *code)
+{
+    if (2 * (cm->nmemo + 1) > cm->capmemo) {
+        size_t cap = cm->capmemo ? 2 * cm->capmemo : 256;
+        struct cmemos *memo = calloc(cap, sizeof(struct cmemos));
+        if (!memo) {return;} // Then it is just compiled again.
+        for (size_t i = 0; i < cm->capmemo; i++) {
+            struct cmemos m = cm->memo[i];
+            if (!m.key) {continue;}
+            size_t j = hash_cmemos(m.key, m.depth, cap);
+            while (memo[j].key) {j = (j + 1) & (cap - 1);}
+            memo[j] = m;
+        }
+        free(cm->memo);
+        cm->memo = memo;
+        cm->capmemo = cap;
+    }
+    size_t i = hash_cmemos(key, depth, cm->capmemo);
+    while (cm->memo[i].key) {i = (i + 1) & (cm->capmemo - 1);}
+    cm->memo[i] = (struct cmemos) {.key = key, .depth = depth, .code = code};
+    cm->nmemo++;
+}
+
+/* ***** ***** */
+
+//  Bracket abstraction.
+
+//  Whether `e` is `((B x) y)`, setting `x` and `y` if so.
+static int is_b(struct combinators *cm, struct cnodes *e
+                                      , struct cnodes **x, struct cnodes **y)
+{
+    if (e->tag != CN_AP || e->ap.fun->tag != CN_AP
+                        || e->ap.fun->ap.fun != &cm->combs[CB]) {
+        return 0;
+    }
+    *x = e->ap.fun->ap.arg;
+    *y = e->ap.arg;
+    return 1;
+}
+
+//  `[l]e` for `e` whose variable of largest level is `l`: by the rules
+//  `[x](f a) = S [x]f [x]a`, `[x]x = I` and `[x]e = K e` if `x` does not
+//  occur in `e`, followed by Turner's
+//
+//      S (K p) I = p           S (B p q) (K r) = C' p q r
+//      S (K p) (B q r) = B* p q r  S p (K r) = C p r
+//      S (K p) q = B p q       S (B p q) r = S' p q r
+//
+//  applied while building rather than after.
+static struct cnodes *abstract(struct combinators *cm, struct cnodes *e
+                                                     , long l)
+{
+    if (e->abs) {return e->abs;}
+    struct cnodes *res, *f, *a, *p, *q, *x, *y;
+    if (e->tag == CN_VAR) {
+        res = &cm->combs[CI];
+    } else if ((f = e->ap.fun)->max != l) {
+        a = e->ap.arg;
+        if (a->tag == CN_VAR) {
+            res = f;
+        } else if (!(q = abstract(cm, a, l))) {
+            res = NULL;
+        } else if (is_b(cm, q, &x, &y)) {
+            res = mk_comb_cnodes(cm, CB1, f, x, y);
+        } else {
+            res = mk_comb_cnodes(cm, CB, f, q, NULL);
+        }
+    } else if ((a = e->ap.arg)->max != l) {
+        if (!(p = abstract(cm, f, l))) {
+            res = NULL;
+        } else if (is_b(cm, p, &x, &y)) {
+            res = mk_comb_cnodes(cm, CC1, x, y, a);
+        } else {
+            res = mk_comb_cnodes(cm, CC, p, a, NULL);
+        }
+    } else {
+        p = abstract(cm, f, l);
+        q = p ? abstract(cm, a, l) : NULL;
+        if (!q) {
+            res = NULL;
+        } else if (is_b(cm, p, &x, &y)) {
+            res = mk_comb_cnodes(cm, CS1, x, y, q);
+        } else {
+            res = mk_comb_cnodes(cm, CS, p, q, NULL);
+        }
+    }
+    e->abs = res;
+    return res;
+}
+
+//  Compiles `t` under `depth` binders, the variable of level `l` being
+//  that of the `l + 1`th lambda from the outside.
+static struct cnodes *compile( struct combinators *cm, struct terms2 *t
+                             , unsigned int depth)
+{
+    struct cnodes *e, *b;
+    switch (tag_terms2(t)) {
+    case VAR2:
+        return mk_var_cnodes(cm, (long) depth - 1 - idx_terms2(t));
+    case NUM2:
+        return mk_num_cnodes(cm, num_terms2(t));
+    case DEF2:
+        t = unfold_def2(t);
+        e = imm_terms2(t) ? NULL : get_cmemos(cm, t, depth);
+        if (e) {return e;}
+        e = compile(cm, t, depth);
+        if (e && !imm_terms2(t)) {put_cmemos(cm, t, depth, e);}
+        return e;
+    default:
+        break;
+    }
+    // Nodes in a heap do not count their references, so may be shared.
+    int shared = t->refcnt != 1;
+    if (shared && (e = get_cmemos(cm, t, depth))) {return e;}
+    if (tag_terms2(t) == LAM2) {
+        b = compile(cm, t->lam, depth + 1);
+        if (!b) {
+            e = NULL;
+        } else if (b->max == (long) depth) {
+            e = abstract(cm, b, depth);
+        } else {
+            e = mk_ap_cnodes(cm, &cm->combs[CK], b);
+        }
+    } else {
+        e = compile(cm, t->app->fun, depth);
+        e = e ? mk_ap_cnodes(cm, e, compile(cm, t->app->arg, depth)) : NULL;
+    }
+    if (shared && e) {put_cmemos(cm, t, depth, e);}
+    return e;
+}
+
+/* ***** ***** */
+
+//  Graph reduction. The spine of the graph being reduced is kept on
+//  `stack`, from its root up to its head.
+
+static int push_combinators(struct combinators *cm, struct cnodes *g)
+{
+    if (cm->sp == cm->capstack) {
+        size_t cap = ((cm->capstack) * 3)/2 + 8;
+        struct cnodes **tmp = realloc(cm->stack, sizeof(struct cnodes*) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return 0;
+        }
+        cm->stack = tmp;
+        cm->capstack = cap;
+    }
+    cm->stack[cm->sp++] = g;
+    return 1;
+}
+
+static struct cnodes *deref(struct cnodes *g)
+{
+    while (g->tag == CN_IND) {g = g->ind;}
+    return g;
+}
+
+static int pow_num(unsigned long m, unsigned long n, unsigned long *res)
+{
+    unsigned long r = 1;
+    for (; n; n--) {
+        if (m && r > IMM2_MAX / m) {return 0;}
+        r *= m;
+    }
+    *res = r;
+    return 1;
+}
+
+static struct cnodes *whnf_cnodes(struct combinators *cm, struct cnodes *g);
+
+//  Whether `g`, in weak head normal form, is a function: a numeral or a
+//  combinator applied to too few arguments. As in `normalize.h`, `(#0 f)`
+//  is a function, and `(#n f)` is one iff `f` is, `f` having been brought
+//  to weak head normal form when `(#n f)` was.
+static int is_value(struct cnodes *g)
+{
+    for (;;) {
+        unsigned int nargs = 0;
+        struct cnodes *ap = NULL;
+        for (g = deref(g); g->tag == CN_AP; g = deref(g->ap.fun)) {
+            ap = g;
+            nargs++;
+        }
+        if (g->tag == CN_COMB) {return nargs < arities[g->comb];}
+        if (g->tag != CN_NUM || nargs > 1) {return 0;}
+        if (!nargs || !g->num) {return 1;}
+        g = ap->ap.arg;
+    }
+}
+
+//  Contracts the redex of a combinator of `k` arguments `x[1..k]`, whose
+//  root is `r`: in place, or by an indirection to an argument.
+static int contract( struct combinators *cm, unsigned int c
+                   , struct cnodes *r, struct cnodes **x)
+{
+    struct cnodes *f, *a;
+    switch (c) {
+    case CI:
+    case CK:
+        r->tag = CN_IND;
+        r->ind = x[1];
+        return 1;
+    case CS:
+        f = mk_ap_cnodes(cm, x[1], x[3]);
+        a = mk_ap_cnodes(cm, x[2], x[3]);
+        break;
+    case CB:
+        f = x[1];
+        a = mk_ap_cnodes(cm, x[2], x[3]);
+        break;
+    case CC:
+        f = mk_ap_cnodes(cm, x[1], x[3]);
+        a = x[2];
+        break;
+    case CS1:
+        f = mk_ap_cnodes(cm, x[1], mk_ap_cnodes(cm, x[2], x[4]));
+        a = mk_ap_cnodes(cm, x[3], x[4]);
+        break;
+    case CB1:
+        f = x[1];
+        a = mk_ap_cnodes(cm, x[2], mk_ap_cnodes(cm, x[3], x[4]));
+        break;
+    default: // `CC1`.
+        f = mk_ap_cnodes(cm, x[1], mk_ap_cnodes(cm, x[2], x[4]));
+        a = x[3];
+        break;
+    }
+    if (!f || !a) {return 0;}
+    r->ap.fun = f;
+    r->ap.arg = a;
+    return 1;
+}
+
+//  Reduces the redex of `nargs` arguments whose head is on top of the
+//  stack, if it is one, and replaces it by its contractum on the stack.
+//  Returns `1` if it did, `0` if it is not a redex and `-1` on failure.
+static int reduce_cnodes(struct combinators *cm, size_t nargs)
+{
+    struct cnodes **sp = cm->stack + cm->sp;
+    struct cnodes *head = sp[-1], *res;
+    size_t k;
+    if (head->tag == CN_COMB) {
+        unsigned int c = head->comb;
+        k = arities[c];
+        if (nargs < k) {return 0;}
+        struct cnodes *x[5];
+        for (size_t i = 1; i <= k; i++) {x[i] = sp[-1 - i]->ap.arg;}
+        head = sp[-1 - k];
+        if (!contract(cm, c, head, x)) {return -1;}
+        res = head->tag == CN_IND ? head->ind : head;
+    } else if (head->tag == CN_NUM && (nargs > 1 || (nargs && head->num))) {
+        // `((#0 f) x)` is `x`, `(#n #m)` is `#m^n` and `((#n f) x)` is
+        // `(f ((#n-1 f) x))` if `f` is a function; otherwise stuck.
+        struct cnodes *f = sp[-2]->ap.arg, *w = NULL;
+        unsigned long pow;
+        if (head->num && !(w = whnf_cnodes(cm, f))) {return -1;}
+        sp = cm->stack + cm->sp;
+        if (w && w->tag == CN_NUM && pow_num(w->num, head->num, &pow)) {
+            k = 1;
+            res = mk_num_cnodes(cm, pow);
+        } else if (nargs < 2 || (w && !is_value(w))) {
+            return 0;
+        } else {
+            k = 2;
+            res = sp[-3]->ap.arg;
+            if (head->num) {
+                struct cnodes *pred = mk_num_cnodes(cm, head->num - 1);
+                res = mk_ap_cnodes( cm, f, mk_ap_cnodes( cm
+                                  , mk_ap_cnodes(cm, pred, f), res));
+            }
+        }
+        if (!res) {return -1;}
+        head = sp[-1 - k];
+        head->tag = CN_IND;
+        head->ind = res;
+    } else {
+        return 0;
+    }
+    cm->sp -= k;
+    cm->stack[cm->sp - 1] = res;
+    return 1;
+}
+
+static struct cnodes *whnf_cnodes(struct combinators *cm, struct cnodes *g)
+{
+    size_t base = cm->sp;
+    int r = push_combinators(cm, g);
+    while (r > 0) {
+        struct cnodes *top = deref(cm->stack[cm->sp - 1]);
+        cm->stack[cm->sp - 1] = top;
+        if (top->tag == CN_AP) {
+            r = push_combinators(cm, top->ap.fun);
+        } else if (!(r = reduce_cnodes(cm, cm->sp - 1 - base))) {
+            g = deref(cm->stack[base]);
+        }
+    }
+    cm->sp = base;
+    return r < 0 ? NULL : g;
+}
+
+/* ***** ***** */
+
+//  Read-back, at `depth` binders, as by `gmachine.h`: a function is
+//  applied to a fresh variable, and a stuck application read back
+//  argument by argument, the last one (or the body) in a loop, the term
+//  it goes into kept on `konts`: `(fun _)` as `fun`, `\_` as `NULL`.
+
+static int push_konts(struct combinators *cm, struct terms2 *fun)
+{
+    if (cm->nkonts == cm->capkonts) {
+        size_t cap = ((cm->capkonts) * 3)/2 + 8;
+        struct terms2 **tmp = realloc(cm->konts, sizeof(struct terms2*) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return 0;
+        }
+        cm->konts = tmp;
+        cm->capkonts = cap;
+    }
+    cm->konts[cm->nkonts++] = fun;
+    return 1;
+}
+
+static struct terms2 *readback_cnodes( struct combinators *cm
+                                     , struct cnodes *g, unsigned int depth)
+{
+    size_t konts = cm->nkonts;
+    struct terms2 *t = NULL;
+    while ((g = whnf_cnodes(cm, g))) {
+        size_t base = cm->sp;
+        struct cnodes *h = g, *w = NULL;
+        for (; h->tag == CN_AP; h = deref(h->ap.fun)) {
+            if (!push_combinators(cm, h)) {cm->sp = base; return NULL;}
+        }
+        if (h->tag == CN_NUM && cm->sp > base && h->num) {
+            w = whnf_cnodes(cm, cm->stack[cm->sp - 1]->ap.arg);
+            if (!w) {cm->sp = base; break;}
+        }
+        if (h->tag == CN_NUM && cm->sp == base) {
+            t = mk_num2(h->num);
+            break;
+        }
+        if (h->tag == CN_VAR || (w && !is_value(w))) {
+            t = h->tag == CN_VAR ? mk_var2((long) depth - 1 - h->lvl)
+                                 : mk_num2(h->num);
+            for (size_t i = cm->sp; t && i-- > base + 1; ) {
+                struct terms2 *a = readback_cnodes( cm
+                                                  , cm->stack[i]->ap.arg
+                                                  , depth);
+                if (!a) {decref_terms2(t); t = NULL; break;}
+                t = mk_nfapp2(t, a);
+            }
+            if (!t || cm->sp == base) {cm->sp = base; break;}
+            g = cm->stack[base]->ap.arg;
+        } else {
+            t = NULL;
+            g = mk_ap_cnodes(cm, g, mk_var_cnodes(cm, depth++));
+        }
+        cm->sp = base;
+        if (!g || !push_konts(cm, t)) {decref_terms2(t); t = NULL; break;}
+        t = NULL;
+    }
+    while (cm->nkonts > konts) {
+        struct terms2 *fun = cm->konts[--cm->nkonts];
+        if (!t) {
+            decref_terms2(fun);
+        } else {
+            t = fun ? mk_nfapp2(fun, t) : mk_nflam2(t);
+        }
+    }
+    return t;
+}
+
+//  Drops the code and graph of the term normalized last.
+static void reset_combinators(struct combinators *cm)
+{
+    clear_arenas(&cm->mem);
+    if (cm->nmemo) {
+        for (size_t i = 0; i < cm->capmemo; i++) {cm->memo[i].key = NULL;}
+        cm->nmemo = 0;
+    }
+}
+
+struct terms2 *normalize_combinators(struct combinators *cm, struct terms2 *t)
+{
+    struct cnodes *g = compile(cm, t, 0);
+    struct terms2 *nf = g ? readback_cnodes(cm, g, 0) : NULL;
+    reset_combinators(cm);
+    return nf;
+}
+
+/* ***** ***** */
+
+static void fprintf_cnodes(FILE *out, struct cnodes *e)
+{
+    switch (e->tag) {
+    case CN_AP:
+        putc_unlocked('(', out);
+        fprintf_cnodes(out, e->ap.fun);
+        putc_unlocked(' ', out);
+        fprintf_cnodes(out, e->ap.arg);
+        putc_unlocked(')', out);
+        break;
+    case CN_COMB:
+        fputs(names[e->comb], out);
+        break;
+    case CN_NUM:
+        fprintf(out, "#%lu", e->num);
+        break;
+    case CN_VAR:
+        fprintf(out, "?%ld", -1 - e->lvl);
+        break;
+    case CN_IND:
+        fprintf_cnodes(out, e->ind);
+        break;
+    }
+}
+
+void fprintf_combinators(FILE *out, struct combinators *cm, struct terms2 *t)
+{
+    struct cnodes *e = compile(cm, t, 0);
+    if (e) {fprintf_cnodes(out, e);}
+    reset_combinators(cm);
+}
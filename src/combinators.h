@@ -0,0 +1,74 @@
+/**
+ *          ╔═════════════╗
+ *          ║ COMBINATORS ║
+ *          ╚═════════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Graph reduction of variable-free combinator code, as another
+ *          alternative to the term rewriting of `normalize.h`. Terms are
+ *          compiled by bracket abstraction to the combinators
+ *
+ *              I x = x                 S f g x = f x (g x)
+ *              K x y = x               B f g x = f (g x)
+ *                                      C f g x = f x g
+ *
+ *          and Turner's S' c f g x = c (f x) (g x), B* c f g x =
+ *          c (f (g x)) and C' c f g x = c (f x) g, which keep the code
+ *          from growing quadratically with the nesting of lambdas. Each
+ *          lambda is abstracted from its body only where its variable
+ *          occurs, the variables being de Bruijn levels so that nothing
+ *          is shifted, and subterms that are shared (or declared) are
+ *          compiled once, so that the code keeps the sharing of the term.
+ *
+ *          Reduction then needs neither environments nor substitution:
+ *          the root of a redex is overwritten by its contractum (or an
+ *          indirection to it), in place, so that it is reduced at most
+ *          once and allocates at most three nodes. Numerals are kept
+ *          compact and reduced as by `gmachine.h`.
+ *
+ *          Normal forms are read back as `terms2` the way `gmachine.h`
+ *          does, combinators applied to too few arguments being
+ *          functions. Bracket abstraction eta-reduces (`S (K f) I` is
+ *          `f`), so the normal forms are those of `normalize_terms2` up
+ *          to eta, and to the folds of numerals that `gmachine.h` skips.
+ */
+
+/* ***** ***** */
+
+#ifndef COMBINATORS_H
+#define COMBINATORS_H
+
+/* ***** ***** */
+
+#include <stdio.h>
+
+#include "lambda_parser.h"
+
+/* ***** ***** */
+
+struct combinators;
+
+struct combinators *alloc_combinators(void);
+
+void free_combinators(struct combinators *cm);
+
+/**
+ * \brief   Normal form of `t` (normal order, i.e., lazily), returned as
+ *          a new reference; `t` is borrowed. The code compiled from `t`,
+ *          and the graph, are freed before returning. Diverges if `t`
+ *          has no normal form.
+ */
+struct terms2 *normalize_combinators(struct combinators *cm, struct terms2 *t);
+
+/**
+ * \brief   Prints the code compiled from `t`, e.g. `((S I) I)` for
+ *          `\x.(x x)`, numerals as `#n` and the free variables of `t` as
+ *          `?i` for the de Bruijn index `i`. It is printed as a tree, so
+ *          shared code is printed once per occurrence.
+ */
+void fprintf_combinators(FILE *out, struct combinators *cm, struct terms2 *t);
+
+/* ***** ***** */
+
+#endif // COMBINATORS_H
@@ -0,0 +1,652 @@
+/*
+    ╔═══════════╗
+    ║ G-MACHINE ║
+    ╚═══════════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lambda_terms.h"
+#include "normalize.h"
+#include "arenas.h"
+#include "gmachine.h"
+
+/* ***** ***** */
+
+//  Graph nodes. `GN_VAR` are the variables that read-back applies
+//  functions to, identified by their de Bruijn level, and free variables
+//  of the term being normalized, which have negative levels.
+
+struct gnodes {
+    enum {GN_AP, GN_SC, GN_NUM, GN_VAR, GN_IND} tag;
+    union {
+        struct {struct gnodes *fun; struct gnodes *arg;} ap;
+        size_t sc;
+        unsigned long num;
+        long lvl;
+        struct gnodes *ind;
+    };
+};
+
+//  Bodies of supercombinators: templates of graphs, with the arguments
+//  as de Bruijn indexes, to be instantiated. Globals (supercombinators
+//  and numerals) are nodes shared by all instances.
+
+struct gexprs {
+    enum {GX_ARG, GX_APP, GX_NODE} tag;
+    union {
+        unsigned int arg;
+        struct {struct gexprs *fun; struct gexprs *arg;} app;
+        struct gnodes *node;
+    };
+};
+
+struct scombs {
+    unsigned int arity;
+    struct gexprs *body;
+    struct gnodes *node;
+};
+
+//  Lifted closed terms, by pointer. Entries made while lifting the
+//  context have `gen == 0` and are kept, those of the term being
+//  normalized are stale as soon as `gen` moves on.
+
+struct lifts {
+    const void *key;
+    struct gexprs *expr;
+    unsigned int gen;
+};
+
+struct gmachines {
+    struct contexts2 *ctx;
+    size_t nlifted;         // Declarations of `ctx` lifted so far.
+    struct arenas perm;     // Supercombinators of the context.
+    struct arenas tmp;      // Those of the term at hand, and the graph.
+    struct arenas *cur;     // Where lifting allocates.
+    unsigned int gen;
+    size_t npersist;        // Supercombinators of the context.
+    size_t nscs;
+    size_t capscs;
+    struct scombs *scs;
+    size_t nmemo;
+    size_t capmemo;         // A power of two, or zero.
+    struct lifts *memo;
+    size_t sp;
+    size_t capstack;
+    struct gnodes **stack;
+    size_t nkonts;
+    size_t capkonts;
+    struct terms2 **konts;  // Pending read-backs, see `readback_gnodes`.
+};
+
+/* ***** ***** */
+
+//  Constructors.
+
+static struct gnodes *mk_gnodes(struct arenas *a, struct gnodes n)
+{
+    struct gnodes *g = bump_arenas(a, sizeof(struct gnodes));
+    if (g) {*g = n;}
+    return g;
+}
+
+static struct gnodes *mk_ap_gnodes( struct gmachines *gm, struct gnodes *fun
+                                                        , struct gnodes *arg)
+{
+    if (!fun || !arg) {return NULL;}
+    return mk_gnodes(&gm->tmp, (struct gnodes) { .tag = GN_AP
+                                               , .ap = {fun, arg}});
+}
+
+static struct gexprs *mk_gexprs(struct gmachines *gm, struct gexprs e)
+{
+    struct gexprs *x = bump_arenas(gm->cur, sizeof(struct gexprs));
+    if (x) {*x = e;}
+    return x;
+}
+
+static struct gexprs *mk_arg_gexprs(struct gmachines *gm, unsigned int i)
+{
+    return mk_gexprs(gm, (struct gexprs) {.tag = GX_ARG, .arg = i});
+}
+
+static struct gexprs *mk_app_gexprs( struct gmachines *gm, struct gexprs *fun
+                                                         , struct gexprs *arg)
+{
+    if (!fun || !arg) {return NULL;}
+    return mk_gexprs(gm, (struct gexprs) {.tag = GX_APP, .app = {fun, arg}});
+}
+
+static struct gexprs *mk_node_gexprs(struct gmachines *gm, struct gnodes n)
+{
+    struct gnodes *g = mk_gnodes(gm->cur, n);
+    if (!g) {return NULL;}
+    return mk_gexprs(gm, (struct gexprs) {.tag = GX_NODE, .node = g});
+}
+
+//  Adds a supercombinator, returning (an expression for) its node.
+static struct gexprs *new_scombs( struct gmachines *gm, unsigned int arity
+                                                      , struct gexprs *body)
+{
+    if (!body) {return NULL;}
+    if (gm->nscs == gm->capscs) {
+        size_t cap = ((gm->capscs) * 3)/2 + 8;
+        struct scombs *tmp = realloc(gm->scs, sizeof(struct scombs) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return NULL;
+        }
+        gm->scs = tmp;
+        gm->capscs = cap;
+    }
+    struct gexprs *e = mk_node_gexprs(gm, (struct gnodes) { .tag = GN_SC
+                                                          , .sc = gm->nscs});
+    if (!e) {return NULL;}
+    gm->scs[gm->nscs++] = (struct scombs) { .arity = arity, .body = body
+                                          , .node = e->node };
+    return e;
+}
+
+/* ***** ***** */
+
+//  The table of lifted closed terms.
+
+static size_t hash_lifts(const void *p, size_t cap)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p >> 3;
+    h *= 0x9e3779b97f4a7c15ull;
+    return (size_t) (h >> 32) & (cap - 1);
+}
+
+static struct lifts *find_lifts(struct gmachines *gm, const void *key)
+{
+    size_t i = hash_lifts(key, gm->capmemo);
+    while (gm->memo[i].key && gm->memo[i].key != key) {
+        i = (i + 1) & (gm->capmemo - 1);
+    }
+    return &gm->memo[i];
+}
+
+static struct gexprs *get_lifts(struct gmachines *gm, const void *key)
+{
+    if (!gm->capmemo) {return NULL;}
+    struct lifts *l = find_lifts(gm, key);
+    if (!l->key || (l->gen && l->gen != gm->gen)) {return NULL;}
+    return l->expr;
+}
+
+//  Stale entries are dropped when the table grows.
+static void put_lifts(struct gmachines *gm, const void *key, struct gexprs *e)
+{
+    if (2 * (gm->nmemo + 1) > gm->capmemo) {
+        size_t live = 0;
+        for (size_t i = 0; i < gm->capmemo; i++) {
+            struct lifts l = gm->memo[i];
+            live += l.key && (!l.gen || l.gen == gm->gen);
+        }
+        size_t cap = 256;
+        while (cap < 4 * (live + 1)) {cap *= 2;}
+        struct lifts *old = gm->memo;
+        size_t oldcap = gm->capmemo;
+        gm->memo = calloc(cap, sizeof(struct lifts));
+        if (!gm->memo) {
+            fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            gm->memo = old;
+            return;
+        }
+        gm->capmemo = cap;
+        gm->nmemo = 0;
+        for (size_t i = 0; i < oldcap; i++) {
+            if (old[i].key && (!old[i].gen || old[i].gen == gm->gen)) {
+                *find_lifts(gm, old[i].key) = old[i];
+                gm->nmemo++;
+            }
+        }
+        free(old);
+    }
+    struct lifts *l = find_lifts(gm, key);
+    if (!l->key) {gm->nmemo++;}
+    *l = (struct lifts) {.key = key, .expr = e, .gen = gm->gen};
+}
+
+/* ***** ***** */
+
+//  Lambda lifting. `map[i]` is the expression for the variable of de
+//  Bruijn index `i` in the supercombinator being built, for `i < n`;
+//  greater indexes are free in the whole term.
+
+static struct gexprs *lift_terms2( struct gmachines *gm, struct terms2 *t
+                                 , struct gexprs **map, unsigned int n);
+
+//  Marks the variables of `t`, under `depth` binders, that are free and
+//  bound in the enclosing scope of `n` variables.
+static void mark_free( struct gmachines *gm, struct terms2 *t
+                     , unsigned int depth, char *mark, unsigned int n)
+{
+    if (!imm_terms2(t) && get_lifts(gm, t)) {return;} // Closed.
+    switch (tag_terms2(t)) {
+    case VAR2:
+        if (idx_terms2(t) >= depth && idx_terms2(t) - depth < n) {
+            mark[idx_terms2(t) - depth] = 1;
+        }
+        break;
+    case LAM2:
+        mark_free(gm, t->lam, depth + 1, mark, n);
+        break;
+    case APP2:
+        mark_free(gm, t->app->fun, depth, mark, n);
+        mark_free(gm, t->app->arg, depth, mark, n);
+        break;
+    default:
+        break;
+    }
+}
+
+//  Lifts `\\..\b` (`k` lambdas) to a supercombinator taking the free
+//  variables of the lambdas, outermost first, and then their `k`
+//  variables, and returns it applied to the former.
+static struct gexprs *lift_lams( struct gmachines *gm, struct terms2 *t
+                               , struct gexprs **map, unsigned int n)
+{
+    struct gexprs *e = get_lifts(gm, t);
+    if (e) {return e;}
+    unsigned int k = 0;
+    struct terms2 *b = t;
+    for (; tag_terms2(b) == LAM2; b = b->lam) {k++;}
+    char *mark = calloc(n + 1, 1);
+    struct gexprs **inner = malloc(sizeof(struct gexprs*) * (k + n + 1));
+    if (!mark || !inner) {
+        fprintf(stderr, "Malloc failed at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        free(mark); free(inner);
+        return NULL;
+    }
+    mark_free(gm, b, k, mark, n);
+    unsigned int m = 0;
+    for (unsigned int i = 0; i < n; i++) {m += mark[i];}
+    for (unsigned int j = 0; j < k; j++) {inner[j] = mk_arg_gexprs(gm, j);}
+    for (unsigned int i = n, pos = 0; i-- > 0; ) {
+        inner[k + i] = mark[i] ? mk_arg_gexprs(gm, k + m - 1 - pos++)
+                               : NULL;
+    }
+    e = new_scombs(gm, m + k, lift_terms2(gm, b, inner, k + n));
+    for (unsigned int i = n; e && i-- > 0; ) {
+        if (mark[i]) {e = mk_app_gexprs(gm, e, map[i]);}
+    }
+    free(mark);
+    free(inner);
+    if (e && !m) {put_lifts(gm, t, e);}
+    return e;
+}
+
+//  Lifts a closed term, sharing it by pointer; a term that is not a
+//  lambda becomes a supercombinator without parameters, i.e., a
+//  constant applicative form.
+static struct gexprs *lift_closed(struct gmachines *gm, struct terms2 *t)
+{
+    struct gexprs *e = imm_terms2(t) ? NULL : get_lifts(gm, t);
+    if (e) {return e;}
+    e = lift_terms2(gm, t, NULL, 0);
+    if (!e || imm_terms2(t)) {return e;}
+    if (e->tag == GX_APP) {e = new_scombs(gm, 0, e);}
+    if (e) {put_lifts(gm, t, e);}
+    return e;
+}
+
+static struct gexprs *lift_terms2( struct gmachines *gm, struct terms2 *t
+                                 , struct gexprs **map, unsigned int n)
+{
+    struct gexprs *e;
+    switch (tag_terms2(t)) {
+    case VAR2:
+        if (idx_terms2(t) < n) {return map[idx_terms2(t)];}
+        return mk_node_gexprs(gm, (struct gnodes) {
+            .tag = GN_VAR, .lvl = -1 - (long) (idx_terms2(t) - n)});
+    case NUM2:
+        return mk_node_gexprs(gm, (struct gnodes) { .tag = GN_NUM
+                                                  , .num = num_terms2(t)});
+    case DEF2:
+        return lift_closed(gm, unfold_def2(t));
+    case LAM2:
+        return lift_lams(gm, t, map, n);
+    case APP2:
+        e = get_lifts(gm, t);
+        if (e) {return e;}
+        return mk_app_gexprs( gm, lift_terms2(gm, t->app->fun, map, n)
+                                , lift_terms2(gm, t->app->arg, map, n));
+    }
+    return NULL;
+}
+
+//  Lifts the declarations added to the context since last time.
+static void sync_gmachines(struct gmachines *gm)
+{
+    if (!gm->ctx) {return;}
+    gm->cur = &gm->perm;
+    unsigned int gen = gm->gen;
+    gm->gen = 0;
+    for (; gm->nlifted < gm->ctx->num; gm->nlifted++) {
+        // Pending declarations (see `index_declterms2`) are lifted along
+        // with the terms that end up referring to them.
+        struct terms2 *t = gm->ctx->els[gm->nlifted].trm;
+        if (t) {lift_closed(gm, t);}
+    }
+    gm->gen = gen;
+    gm->npersist = gm->nscs;
+}
+
+struct gmachines *alloc_gmachines(struct contexts2 *ctx)
+{
+    struct gmachines *gm = calloc(1, sizeof(struct gmachines));
+    MALCHECK(gm);
+    gm->ctx = ctx;
+    gm->gen = 1;
+    sync_gmachines(gm);
+    return gm;
+}
+
+void free_gmachines(struct gmachines *gm)
+{
+    if (!gm) {return;}
+    free_arenas(&gm->perm);
+    free_arenas(&gm->tmp);
+    free(gm->scs);
+    free(gm->memo);
+    free(gm->stack);
+    free(gm->konts);
+    free(gm);
+}
+
+/* ***** ***** */
+
+//  Graph reduction. The spine of the graph being reduced is kept on
+//  `stack`, from its root up to its head.
+
+static int push_gmachines(struct gmachines *gm, struct gnodes *g)
+{
+    if (gm->sp == gm->capstack) {
+        size_t cap = ((gm->capstack) * 3)/2 + 8;
+        struct gnodes **tmp = realloc(gm->stack, sizeof(struct gnodes*) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return 0;
+        }
+        gm->stack = tmp;
+        gm->capstack = cap;
+    }
+    gm->stack[gm->sp++] = g;
+    return 1;
+}
+
+static struct gnodes *deref(struct gnodes *g)
+{
+    while (g->tag == GN_IND) {g = g->ind;}
+    return g;
+}
+
+static struct gnodes *instantiate( struct gmachines *gm, struct gexprs *e
+                                 , struct gnodes **args)
+{
+    switch (e->tag) {
+    case GX_ARG:
+        return args[e->arg];
+    case GX_NODE:
+        return e->node;
+    case GX_APP:
+        return mk_ap_gnodes( gm, instantiate(gm, e->app.fun, args)
+                               , instantiate(gm, e->app.arg, args));
+    }
+    return NULL;
+}
+
+static int pow_num(unsigned long m, unsigned long n, unsigned long *res)
+{
+    unsigned long r = 1;
+    for (; n; n--) {
+        if (m && r > IMM2_MAX / m) {return 0;}
+        r *= m;
+    }
+    *res = r;
+    return 1;
+}
+
+static struct gnodes *whnf_gnodes(struct gmachines *gm, struct gnodes *g);
+
+//  Whether `g`, in weak head normal form, is a function, i.e., what a
+//  lambda would be in `normalize.h`: a numeral or a supercombinator
+//  applied to too few arguments. As there, `(#0 f)` is a function, and
+//  `(#n f)` is one iff `f` is, `f` having been brought to weak head
+//  normal form when `(#n f)` was.
+static int is_value(struct gmachines *gm, struct gnodes *g)
+{
+    for (;;) {
+        unsigned int nargs = 0;
+        struct gnodes *ap = NULL;
+        for (g = deref(g); g->tag == GN_AP; g = deref(g->ap.fun)) {
+            ap = g;
+            nargs++;
+        }
+        if (g->tag == GN_SC) {return nargs < gm->scs[g->sc].arity;}
+        if (g->tag != GN_NUM || nargs > 1) {return 0;}
+        if (!nargs || !g->num) {return 1;}
+        g = ap->ap.arg;
+    }
+}
+
+//  Reduces the redex of `nargs` arguments whose head is on top of the
+//  stack, if it is one, overwriting its root with an indirection to the
+//  result and replacing it by the result on the stack. Returns `1` if it
+//  did, `0` if it is not a redex and `-1` on failure.
+static int reduce_gnodes(struct gmachines *gm, size_t nargs)
+{
+    struct gnodes **sp = gm->stack + gm->sp;
+    struct gnodes *head = sp[-1], *res;
+    size_t k;
+    if (head->tag == GN_SC) {
+        k = gm->scs[head->sc].arity;
+        if (nargs < k) {return 0;}
+        // The arguments, in place of their applications, are then at
+        // `sp[-1 - k + i]` for the de Bruijn index `i`.
+        head = sp[-1 - k];
+        for (size_t i = 2; i <= k + 1; i++) {sp[-i] = sp[-i]->ap.arg;}
+        res = instantiate(gm, gm->scs[sp[-1]->sc].body, sp - 1 - k);
+    } else if (head->tag == GN_NUM && (nargs > 1 || (nargs && head->num))) {
+        // `((#0 f) x)` is `x`, `(#n #m)` is `#m^n` and `((#n f) x)` is
+        // `(f ((#n-1 f) x))` if `f` is a function; otherwise stuck.
+        struct gnodes *f = sp[-2]->ap.arg, *w = NULL;
+        unsigned long pow;
+        if (head->num && !(w = whnf_gnodes(gm, f))) {return -1;}
+        sp = gm->stack + gm->sp;
+        if (w && w->tag == GN_NUM && pow_num(w->num, head->num, &pow)) {
+            k = 1;
+            res = mk_gnodes(&gm->tmp, (struct gnodes) { .tag = GN_NUM
+                                                      , .num = pow});
+        } else if (nargs < 2 || (w && !is_value(gm, w))) {
+            return 0;
+        } else {
+            k = 2;
+            res = sp[-3]->ap.arg;
+            if (head->num) {
+                struct gnodes *pred = mk_gnodes(&gm->tmp, (struct gnodes)
+                                  {.tag = GN_NUM, .num = head->num - 1});
+                res = mk_ap_gnodes( gm, f, mk_ap_gnodes( gm
+                                  , mk_ap_gnodes(gm, pred, f), res));
+            }
+        }
+        head = sp[-1 - k];
+    } else {
+        return 0;
+    }
+    if (!res) {return -1;}
+    // `head` is now the root of the redex (the supercombinator itself
+    // for a constant applicative form).
+    head->tag = GN_IND;
+    head->ind = res;
+    gm->sp -= k;
+    gm->stack[gm->sp - 1] = res;
+    return 1;
+}
+
+static struct gnodes *whnf_gnodes(struct gmachines *gm, struct gnodes *g)
+{
+    size_t base = gm->sp;
+    int r = push_gmachines(gm, g);
+    while (r > 0) {
+        struct gnodes *top = deref(gm->stack[gm->sp - 1]);
+        gm->stack[gm->sp - 1] = top;
+        if (top->tag == GN_AP) {
+            r = push_gmachines(gm, top->ap.fun);
+        } else if (!(r = reduce_gnodes(gm, gm->sp - 1 - base))) {
+            g = deref(gm->stack[base]);
+        }
+    }
+    gm->sp = base;
+    return r < 0 ? NULL : g;
+}
+
+/* ***** ***** */
+
+//  Read-back, at `depth` binders. A function is applied to a fresh
+//  variable, and a stuck application read back argument by argument.
+//  Normal forms nest as deep as, e.g., the numerals they contain, so the
+//  last argument, or the body, is read back in a loop rather than by
+//  recursion, the term it goes into kept on `konts`: `(fun _)` as `fun`,
+//  `\_` as `NULL`.
+
+static int push_konts(struct gmachines *gm, struct terms2 *fun)
+{
+    if (gm->nkonts == gm->capkonts) {
+        size_t cap = ((gm->capkonts) * 3)/2 + 8;
+        struct terms2 **tmp = realloc(gm->konts, sizeof(struct terms2*) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return 0;
+        }
+        gm->konts = tmp;
+        gm->capkonts = cap;
+    }
+    gm->konts[gm->nkonts++] = fun;
+    return 1;
+}
+
+static struct terms2 *readback_gnodes( struct gmachines *gm, struct gnodes *g
+                                     , unsigned int depth)
+{
+    size_t konts = gm->nkonts;
+    struct terms2 *t = NULL;
+    while ((g = whnf_gnodes(gm, g))) {
+        size_t base = gm->sp;
+        struct gnodes *h = g, *w = NULL;
+        for (; h->tag == GN_AP; h = deref(h->ap.fun)) {
+            if (!push_gmachines(gm, h)) {gm->sp = base; return NULL;}
+        }
+        if (h->tag == GN_NUM && gm->sp > base && h->num) {
+            w = whnf_gnodes(gm, gm->stack[gm->sp - 1]->ap.arg);
+            if (!w) {gm->sp = base; break;}
+        }
+        if (h->tag == GN_NUM && gm->sp == base) {
+            t = mk_num2(h->num);
+            break;
+        }
+        if (h->tag == GN_VAR || (w && !is_value(gm, w))) {
+            t = h->tag == GN_VAR ? mk_var2((long) depth - 1 - h->lvl)
+                                 : mk_num2(h->num);
+            for (size_t i = gm->sp; t && i-- > base + 1; ) {
+                struct terms2 *a = readback_gnodes( gm
+                                                  , gm->stack[i]->ap.arg
+                                                  , depth);
+                if (!a) {decref_terms2(t); t = NULL; break;}
+                t = mk_nfapp2(t, a);
+            }
+            if (!t || gm->sp == base) {gm->sp = base; break;}
+            g = gm->stack[base]->ap.arg;
+        } else {
+            t = NULL;
+            g = mk_ap_gnodes(gm, g, mk_gnodes( &gm->tmp, (struct gnodes)
+                                         {.tag = GN_VAR, .lvl = depth++}));
+        }
+        gm->sp = base;
+        if (!g || !push_konts(gm, t)) {decref_terms2(t); t = NULL; break;}
+        t = NULL;
+    }
+    while (gm->nkonts > konts) {
+        struct terms2 *fun = gm->konts[--gm->nkonts];
+        if (!t) {
+            decref_terms2(fun);
+        } else {
+            t = fun ? mk_nfapp2(fun, t) : mk_nflam2(t);
+        }
+    }
+    return t;
+}
+
+//  Drops what was lifted from, and built for, the term normalized last.
+static void reset_gmachines(struct gmachines *gm)
+{
+    clear_arenas(&gm->tmp);
+    gm->nscs = gm->npersist;
+    for (size_t i = 0; i < gm->nscs; i++) {
+        if (!gm->scs[i].arity) {
+            *gm->scs[i].node = (struct gnodes) {.tag = GN_SC, .sc = i};
+        }
+    }
+    gm->gen = gm->gen + 1 ? gm->gen + 1 : 1;
+}
+
+struct terms2 *normalize_gmachines(struct gmachines *gm, struct terms2 *t)
+{
+    sync_gmachines(gm);
+    gm->cur = &gm->tmp;
+    struct terms2 *nf = NULL;
+    struct gexprs *e = lift_terms2(gm, t, NULL, 0);
+    struct gnodes *g = e ? instantiate(gm, e, NULL) : NULL;
+    if (g) {nf = readback_gnodes(gm, g, 0);}
+    reset_gmachines(gm);
+    return nf;
+}
+
+/* ***** ***** */
+
+static void fprintf_gexprs(FILE *out, struct gexprs *e)
+{
+    switch (e->tag) {
+    case GX_ARG:
+        fprintf(out, "%u", e->arg);
+        break;
+    case GX_APP:
+        putc_unlocked('(', out);
+        fprintf_gexprs(out, e->app.fun);
+        putc_unlocked(' ', out);
+        fprintf_gexprs(out, e->app.arg);
+        putc_unlocked(')', out);
+        break;
+    case GX_NODE:
+        if (e->node->tag == GN_NUM) {
+            fprintf(out, "#%lu", e->node->num);
+        } else if (e->node->tag == GN_VAR) {
+            fprintf(out, "?%ld", -1 - e->node->lvl);
+        } else {
+            fprintf(out, "$%zu", e->node->sc);
+        }
+        break;
+    }
+}
+
+void fprintf_gmachines(FILE *out, struct gmachines *gm)
+{
+    sync_gmachines(gm);
+    for (size_t i = 0; i < gm->npersist; i++) {
+        fprintf(out, "$%zu/%u = ", i, gm->scs[i].arity);
+        fprintf_gexprs(out, gm->scs[i].body);
+        putc_unlocked('\n', out);
+    }
+}
@@ -0,0 +1,78 @@
+/**
+ *          ╔═══════════╗
+ *          ║ G-MACHINE ║
+ *          ╚═══════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Lazy graph reduction of de Bruijn terms, as an alternative to
+ *          the term rewriting of `normalize.h`. Terms are lambda lifted
+ *          into supercombinators: every (maximal run of) lambda becomes
+ *          a global function taking its free variables as extra leading
+ *          parameters, so that no body has a lambda inside. Reduction
+ *          then instantiates the body of a supercombinator applied to
+ *          enough arguments as a graph, the arguments shared rather
+ *          than copied, and overwrites the root of the redex with (an
+ *          indirection to) the result, so that every redex is reduced at
+ *          most once, however often it is referred to.
+ *
+ *          The terms of a context are lifted once, closed subterms shared
+ *          by pointer (e.g. references to declarations) to the same
+ *          supercombinator, and a declared term that is not a lambda to a
+ *          constant applicative form, which is evaluated at most once per
+ *          `normalize_gmachines`.
+ *
+ *          Normal forms are read back from the graph by reducing to weak
+ *          head normal form and reading back the arguments, functions
+ *          being applied to fresh variables. Numerals are kept compact as
+ *          in `normalize_terms2`, but the folds of its normal forms, such
+ *          as `((#a f) ((#b f) x))` to `((#a+b f) x)`, are not done; the
+ *          normal forms of the two are equal up to those.
+ */
+
+/* ***** ***** */
+
+#ifndef GMACHINE_H
+#define GMACHINE_H
+
+/* ***** ***** */
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "lambda_parser.h"
+
+/* ***** ***** */
+
+struct gmachines;
+
+/**
+ * \brief   Allocates a machine for the terms of `ctx` (which may be
+ *          `NULL`), lifting those already in it. Declarations added to
+ *          `ctx` later are lifted as needed. The terms of `ctx` must
+ *          neither be freed nor moved (by `collect_heaps`) while the
+ *          machine lives.
+ */
+struct gmachines *alloc_gmachines(struct contexts2 *ctx);
+
+void free_gmachines(struct gmachines *gm);
+
+/**
+ * \brief   Normal form of `t` (normal order, i.e., lazily), returned as
+ *          a new reference; `t` is borrowed. The supercombinators lifted
+ *          from `t`, and the graph, are freed before returning, those of
+ *          the context kept. Diverges if `t` has no normal form.
+ */
+struct terms2 *normalize_gmachines(struct gmachines *gm, struct terms2 *t);
+
+/**
+ * \brief   Prints the supercombinators of the context, one per line, as
+ *          `$i/n = body`, `n` being the arity and the body in textual de
+ *          Bruijn form (parameter `0` being the last), `$j` referring to
+ *          supercombinators.
+ */
+void fprintf_gmachines(FILE *out, struct gmachines *gm);
+
+/* ***** ***** */
+
+#endif // GMACHINE_H
@@ -0,0 +1,276 @@
+/*
+    ╔══════╗
+    ║ HEAP ║
+    ╚══════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lambda_terms.h"
+#include "heap.h"
+
+/* ***** ***** */
+
+//  A heap is a list of blocks, filled in order by bumping `used`. The
+//  nodes in a block are laid out back to back, so that the blocks can
+//  be walked node by node, sizes following from the tags.
+
+struct blocks {
+    struct blocks *next;
+    size_t size;
+    size_t used;
+    char mem[];
+};
+
+struct scans {
+    scanners scan;
+    void *obj;
+};
+
+struct heaps {
+    size_t block;
+    struct blocks *first;
+    struct blocks *last;
+    size_t nroots;
+    size_t caproots;
+    struct terms2 ***roots;
+    size_t nscans;
+    size_t capscans;
+    struct scans *scans;
+    struct heapstats stats;
+};
+
+_Thread_local struct heaps *cur_heaps;
+
+//  Forwarded nodes, i.e., nodes already copied by the collection in
+//  progress, have this `refcnt` and their copy in `fwd`.
+#define REFCNT_FWD UINT_MAX
+
+#define ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+/* ***** ***** */
+
+struct heaps *alloc_heaps(size_t block)
+{
+    struct heaps *h = malloc(sizeof(struct heaps));
+    MALCHECK(h);
+    *h = (struct heaps) {.block = block > 4096 ? block : 4096};
+    return h;
+}
+
+static struct blocks *alloc_blocks(size_t size)
+{
+    struct blocks *b = malloc(sizeof(struct blocks) + size);
+    MALCHECK(b);
+    *b = (struct blocks) {.next = NULL, .size = size, .used = 0};
+    return b;
+}
+
+void *bump_heaps(struct heaps *h, size_t size)
+{
+    size = ALIGN(size);
+    struct blocks *b = h->last;
+    if (!b || b->size - b->used < size) {
+        b = alloc_blocks(size > h->block ? size : h->block);
+        if (!b) {return NULL;}
+        if (h->last) {h->last->next = b;} else {h->first = b;}
+        h->last = b;
+    }
+    void *p = b->mem + b->used;
+    b->used += size;
+    h->stats.allocated += size;
+    return p;
+}
+
+struct heaps *use_heaps(struct heaps *h)
+{
+    struct heaps *prev = cur_heaps;
+    cur_heaps = h;
+    return prev;
+}
+
+static size_t size_terms2(struct terms2 *t)
+{
+    switch (t->tag) {
+    case APP2:
+        return ALIGN(sizeof(struct terms2) + sizeof(struct apps2));
+    case DEF2:
+        return ALIGN(sizeof(struct terms2) + sizeof(struct defs2));
+    default:
+        return ALIGN(sizeof(struct terms2));
+    }
+}
+
+//  Releases the references that a dead node holds to counted nodes.
+static void release_terms2(struct terms2 *t)
+{
+    switch (t->tag) {
+    case LAM2:
+        decref_terms2(t->lam);
+        break;
+    case APP2:
+        decref_terms2(t->app->fun);
+        decref_terms2(t->app->arg);
+        break;
+    default:
+        break;
+    }
+}
+
+//  Frees the blocks from `b` on, releasing the nodes not forwarded
+//  first: they may point to one another across blocks.
+static void sweep_blocks(struct blocks *b)
+{
+    for (struct blocks *c = b; c; c = c->next) {
+        for (size_t off = 0; off < c->used; ) {
+            struct terms2 *t = (struct terms2*) (c->mem + off);
+            off += size_terms2(t);
+            if (t->refcnt != REFCNT_FWD) {release_terms2(t);}
+        }
+    }
+    while (b) {
+        struct blocks *next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+void free_heaps(struct heaps *h)
+{
+    if (!h) {return;}
+    if (cur_heaps == h) {cur_heaps = NULL;}
+    sweep_blocks(h->first);
+    free(h->roots); free(h->scans); free(h);
+}
+
+/* ***** ***** */
+
+//  Roots.
+
+void push_roots_heaps(struct heaps *h, struct terms2 **slot)
+{
+    if (h->nroots == h->caproots) {
+        size_t cap = ((h->caproots) * 3)/2 + 8;
+        struct terms2 ***tmp = realloc( h->roots
+                                      , sizeof(struct terms2**) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return;
+        }
+        h->roots = tmp;
+        h->caproots = cap;
+    }
+    h->roots[h->nroots++] = slot;
+}
+
+void pop_roots_heaps(struct heaps *h, size_t n)
+{
+    h->nroots = n < h->nroots ? h->nroots - n : 0;
+}
+
+void add_scanner_heaps(struct heaps *h, scanners scan, void *obj)
+{
+    if (h->nscans == h->capscans) {
+        size_t cap = ((h->capscans) * 3)/2 + 8;
+        struct scans *tmp = realloc(h->scans, sizeof(struct scans) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return;
+        }
+        h->scans = tmp;
+        h->capscans = cap;
+    }
+    h->scans[h->nscans++] = (struct scans) {.scan = scan, .obj = obj};
+}
+
+void scan_contexts2(void *obj, visitors v, void *env)
+{
+    struct contexts2 *ctx = obj;
+    for (size_t i = 0; i < ctx->num; i++) {
+        if (ctx->els[i].trm) {v(&ctx->els[i].trm, env);}
+        if (ctx->els[i].ref) {v(&ctx->els[i].ref, env);}
+    }
+}
+
+/* ***** ***** */
+
+//  Collection. The live nodes are copied to fresh blocks, appended to
+//  the heap, which are then scanned in order: a breadth-first copy, with
+//  the blocks themselves as the queue.
+
+static struct terms2 *copy_terms2(struct heaps *h, struct terms2 *t)
+{
+    if (!t || imm_terms2(t)) {return t;}
+    if (t->refcnt == REFCNT_FWD) {return t->fwd;}
+    if (t->refcnt) {return t;} // Counted, so not in the heap.
+    size_t size = size_terms2(t);
+    struct terms2 *u = bump_heaps(h, size);
+    if (!u) {
+        // Some live nodes may already be forwarded, so there is no
+        // consistent heap to return to.
+        fprintf(stderr, "Malloc failed at line %d in `%s`.\n",
+                __LINE__, __FUNCTION__);
+        abort();
+    }
+    memcpy(u, t, size);
+    if (t->tag == APP2) {u->app = (struct apps2*) (u + 1);}
+    if (t->tag == DEF2) {u->def = (struct defs2*) (u + 1);}
+    h->stats.copied += size;
+    t->refcnt = REFCNT_FWD;
+    t->fwd = u;
+    return u;
+}
+
+static void visit_roots(struct terms2 **slot, void *env)
+{
+    *slot = copy_terms2(env, *slot);
+}
+
+void collect_heaps(struct heaps *h)
+{
+    struct blocks *from = h->first;
+    h->first = h->last = NULL;
+    for (size_t i = 0; i < h->nroots; i++) {visit_roots(h->roots[i], h);}
+    for (size_t i = 0; i < h->nscans; i++) {
+        h->scans[i].scan(h->scans[i].obj, visit_roots, h);
+    }
+    for (struct blocks *b = h->first; b; b = b->next) {
+        for (size_t off = 0; off < b->used; ) {
+            struct terms2 *t = (struct terms2*) (b->mem + off);
+            off += size_terms2(t);
+            if (t->tag == LAM2) {
+                t->lam = copy_terms2(h, t->lam);
+            } else if (t->tag == APP2) {
+                t->app->fun = copy_terms2(h, t->app->fun);
+                t->app->arg = copy_terms2(h, t->app->arg);
+            }
+        }
+    }
+    sweep_blocks(from);
+    size_t live = 0;
+    for (struct blocks *b = h->first; b; b = b->next) {live += b->used;}
+    h->stats.collections++;
+    h->stats.allocated = 0;
+    h->stats.live = live;
+}
+
+int maybe_collect_heaps(struct heaps *h)
+{
+    size_t min = h->stats.live > h->block ? h->stats.live : h->block;
+    if (h->stats.allocated < min) {return 0;}
+    collect_heaps(h);
+    return 1;
+}
+
+struct heapstats stats_heaps(struct heaps *h)
+{
+    return h->stats;
+}
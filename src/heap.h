@@ -0,0 +1,123 @@
+/**
+ *          ╔══════╗
+ *          ║ HEAP ║
+ *          ╚══════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   An optional garbage collected heap for `terms2`, as an
+ *          alternative to reference counting. While a heap is in use
+ *          (see `use_heaps`) by a thread, all `terms2` nodes it builds
+ *          are bump allocated in the heap, and `incref_terms2` and
+ *          `decref_terms2` are no-ops on them. The heap is reclaimed by
+ *          a Cheney style copying collector, which also compacts the
+ *          live nodes, in allocation order, for locality.
+ *
+ *          Collection is precise and only happens when asked for, by
+ *          `collect_heaps` or `maybe_collect_heaps`, at points where all
+ *          live nodes are reachable from the roots: the slots pushed by
+ *          `push_roots_heaps` and those visited by the scanners added by
+ *          `add_scanner_heaps`. Other pointers into the heap are left
+ *          dangling by a collection.
+ *
+ *          Heap nodes may point to reference counted nodes, built before
+ *          the heap was in use, but not the other way around: terms built
+ *          in a heap must not be handed to code running without it.
+ */
+
+/* ***** ***** */
+
+#ifndef HEAP_H
+#define HEAP_H
+
+/* ***** ***** */
+
+#include <stddef.h>
+
+#include "lambda_parser.h"
+
+/* ***** ***** */
+
+struct heaps;
+
+struct heapstats {
+    size_t collections;
+    size_t allocated;   // Bytes allocated since the last collection.
+    size_t live;        // Bytes surviving the last collection.
+    size_t copied;      // Bytes copied by all collections.
+};
+
+/**
+ * \brief   Allocates an empty heap, growing in blocks of (at least)
+ *          `block` bytes. `maybe_collect_heaps` collects no more often
+ *          than every `block` bytes allocated.
+ */
+struct heaps *alloc_heaps(size_t block);
+
+/**
+ * \brief   Frees the heap, and with it all nodes in it. Any reference
+ *          counted nodes they point to are released.
+ */
+void free_heaps(struct heaps *h);
+
+/**
+ * \brief   Makes `h` the heap that the calling thread allocates `terms2`
+ *          nodes in, or, if `NULL`, goes back to reference counting.
+ *          Returns the heap previously in use.
+ */
+struct heaps *use_heaps(struct heaps *h);
+
+/**
+ * \brief   Allocates `size` bytes in `h`. Used by the constructors of
+ *          `terms2` nodes. Returns `NULL` if a new block is needed and
+ *          cannot be allocated; the heap is then left as it was.
+ */
+void *bump_heaps(struct heaps *h, size_t size);
+
+/**
+ * \brief   Registers (and unregisters, the `n` most recently pushed)
+ *          roots, as addresses of variables holding terms. The terms
+ *          may be updated by a collection.
+ */
+void push_roots_heaps(struct heaps *h, struct terms2 **slot);
+void pop_roots_heaps(struct heaps *h, size_t n);
+
+/**
+ * \brief   Roots held in a data structure `obj`: a scanner calls `v` on
+ *          (the address of) each of them.
+ */
+typedef void (*visitors)(struct terms2 **slot, void *env);
+typedef void (*scanners)(void *obj, visitors v, void *env);
+
+/**
+ * \brief   Adds `scan(obj, ...)` to the roots of `h`, for as long as `h`
+ *          lives.
+ */
+void add_scanner_heaps(struct heaps *h, scanners scan, void *obj);
+
+/**
+ * \brief   A `scanners` for the terms of a `contexts2`.
+ */
+void scan_contexts2(void *ctx, visitors v, void *env);
+
+/**
+ * \brief   Collects `h`, copying the nodes reachable from its roots.
+ */
+void collect_heaps(struct heaps *h);
+
+/**
+ * \brief   Collects `h` if as many bytes have been allocated since the
+ *          last collection as survived it (and at least the block size
+ *          of `h`), i.e., keeps the amortized cost of collection linear
+ *          in allocation. Returns `1` if it collected, `0` otherwise.
+ */
+int maybe_collect_heaps(struct heaps *h);
+
+/**
+ * \brief   Returns the counters of `h`.
+ */
+struct heapstats stats_heaps(struct heaps *h);
+
+/* ***** ***** */
+
+#endif // HEAP_H
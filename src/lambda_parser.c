@@ -12,51 +12,54 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "lambda_parser.h"
+#include "lambda_terms.h"
+#include "normalize.h"
+#include "lexer.h"
 
 /* ***** ***** */
 
-#define MALCHECK(s) if(!s) {                               \
-    fprintf(stderr, "Malloc failed at line %d in `%s`.\n"  \
-                  , __LINE__, __FUNCTION__);               \
-    return NULL;                                           \
-}                                                          \
+//  Allocation.
+
+_Thread_local const struct allocators *cur_allocators;
+
+const struct allocators *use_allocators(const struct allocators *a)
+{
+    const struct allocators *prev = cur_allocators;
+    cur_allocators = a;
+    return prev;
+}
 
 /* ***** ***** */
 
 //  The obvious AST encoding.
 
-struct terms1 {
-    unsigned int refcnt;
-    enum {VAR1, LAM1, APP1} tag;
-    union {
-        char *var;
-        struct lams1 {char *var; struct terms1 *bod;} *lam;
-        struct apps1 {struct terms1 *fun; struct terms1 *arg;} *app;
-    };
-};
-
 void decref_terms1(struct terms1 *t0)
 {
     if (!t0) {return;}
     if (t0->refcnt <= 1) {
         switch (t0->tag) {
         case VAR1:
-            free(t0->var);
-            free(t0);
+            free_slices(t0->var);
+            free_bytes(t0);
+            break;
+        case NUM1:
+            free_bytes(t0);
             break;
         case LAM1:
-            free(t0->lam->var);
+            free_slices(t0->lam->var);
             decref_terms1(t0->lam->bod);
-            free(t0->lam);
-            free(t0);
+            free_bytes(t0->lam);
+            free_bytes(t0);
             break;
         case APP1:
             decref_terms1(t0->app->fun);
             decref_terms1(t0->app->arg);
-            free(t0->app);
-            free(t0);
+            free_bytes(t0->app);
+            free_bytes(t0);
             break;
         }
     } else {
@@ -69,25 +72,66 @@ void incref_terms1(struct terms1 *t0)
     t0->refcnt++;
 }
 
+//  Prints an unsigned without going through `fprintf`'s format parsing;
+//  indexes are most of what we print.
+static void fputu(unsigned long u, FILE *out)
+{
+    char buf[24];
+    int n = 0;
+    do {buf[n++] = '0' + u % 10; u /= 10;} while (u);
+    while (n) {putc_unlocked(buf[--n], out);}
+}
+
 void fprintf_terms1(FILE *out, struct terms1 *t0)
 {
     if (!t0) {
         fprintf(out, "`NULL`-term.");
+        return;
     }
     switch (t0->tag) {
     case VAR1:
-        fprintf(out, "%s", t0->var);
+        fwrite(t0->var.str, 1, t0->var.len, out);
+        break;
+    case NUM1:
+        putc_unlocked('#', out);
+        fputu(t0->num, out);
         break;
     case LAM1:
-        fprintf(out, "\\%s.", t0->lam->var);
+        putc_unlocked('\\', out);
+        fwrite(t0->lam->var.str, 1, t0->lam->var.len, out);
+        putc_unlocked('.', out);
         fprintf_terms1(out, t0->lam->bod);
         break;
     case APP1:
-        fprintf(out, "(");
+        putc_unlocked('(', out);
         fprintf_terms1(out, t0->app->fun);
-        fprintf(out, " ");
+        putc_unlocked(' ', out);
         fprintf_terms1(out, t0->app->arg);
-        fprintf(out, ")");
+        putc_unlocked(')', out);
+        break;
+    }
+}
+
+static void detach_slices(struct slices *x)
+{
+    if (!x->own) {*x = copy_slices(*x);}
+}
+
+void detach_terms1(struct terms1 *t0)
+{
+    switch (t0->tag) {
+    case VAR1:
+        detach_slices(&t0->var);
+        break;
+    case NUM1:
+        break;
+    case LAM1:
+        detach_slices(&t0->lam->var);
+        detach_terms1(t0->lam->bod);
+        break;
+    case APP1:
+        detach_terms1(t0->app->fun);
+        detach_terms1(t0->app->arg);
         break;
     }
 }
@@ -97,33 +141,28 @@ void fprintf_terms1(FILE *out, struct terms1 *t0)
 
 // de Bruijn AST type.
 
-struct terms2 {
-    unsigned int refcnt;
-    enum {VAR2, LAM2, APP2} tag;
-    union {
-        unsigned int idx;
-        struct terms2 *lam;
-        struct apps2 {struct terms2 *fun; struct terms2 *arg;} *app;
-    };
-};
-
 void decref_terms2(struct terms2 *t0)
 {
-    if (!t0) {return;}
+    if (!t0 || !counted_terms2(t0)) {return;}
     if (t0->refcnt <= 1) {
-        switch (t0->tag) {
+        switch (tag_terms2(t0)) {
         case VAR2:
-            free(t0);
+        case NUM2:
+            free_bytes(t0);
             break;
         case LAM2:
             decref_terms2(t0->lam);
-            free(t0);
+            free_bytes(t0);
+            break;
+        case DEF2:
+            free_bytes(t0->def);
+            free_bytes(t0);
             break;
         case APP2:
             decref_terms2(t0->app->fun);
             decref_terms2(t0->app->arg);
-            free(t0->app);
-            free(t0);
+            free_bytes(t0->app);
+            free_bytes(t0);
             break;
         }
     } else {
@@ -133,28 +172,39 @@ void decref_terms2(struct terms2 *t0)
 
 void incref_terms2(struct terms2 *t0)
 {
+    if (!counted_terms2(t0)) {return;}
     t0->refcnt++;
 }
 
 void fprintf_terms2(FILE *out, struct terms2 *t0)
 {
+    struct slices x;
     if (!t0) {
         fprintf(out, "`NULL`-term.");
+        return;
     }
-    switch (t0->tag) {
+    switch (tag_terms2(t0)) {
     case VAR2:
-        fprintf(out, "%u", t0->idx);
+        fputu(idx_terms2(t0), out);
+        break;
+    case NUM2:
+        putc_unlocked('#', out);
+        fputu(num_terms2(t0), out);
+        break;
+    case DEF2:
+        x = name_def2(t0);
+        fwrite(x.str, 1, x.len, out);
         break;
     case LAM2:
-        fprintf(out, "\\");
+        putc_unlocked('\\', out);
         fprintf_terms2(out, t0->lam);
         break;
     case APP2:
-        fprintf(out, "(");
+        putc_unlocked('(', out);
         fprintf_terms2(out, t0->app->fun);
-        fprintf(out, " ");
+        putc_unlocked(' ', out);
         fprintf_terms2(out, t0->app->arg);
-        fprintf(out, ")");
+        putc_unlocked(')', out);
         break;
     }
 }
@@ -162,19 +212,14 @@ void fprintf_terms2(FILE *out, struct terms2 *t0)
 
 //  Names (arrays of bound variables).
 
-struct names {
-    size_t cap; // Number of allocated names.
-    size_t num; // Number of initialized names.
-    char **els;
-};
-    
 struct names *alloc_names(size_t cap)
 {
-    struct names *xs = malloc(sizeof(struct names));
+    struct names *xs = alloc_bytes(sizeof(struct names));
     MALCHECK(xs);
     xs->cap = cap;
     xs->num = 0;
-    char **tmp = malloc(sizeof(char*) * cap);
+    xs->cur = 0;
+    struct binders *tmp = alloc_bytes(sizeof(struct binders) * cap);
     MALCHECK(tmp);
     xs->els = tmp;
     return xs;
@@ -182,50 +227,63 @@ struct names *alloc_names(size_t cap)
 
 void free_names(struct names *xs)
 {
-    for (int i = 0; i < xs->num; i++){free(xs->els[i]);}
-    free(xs->els); free(xs);
+    for (size_t i = 0; i < xs->num; i++){free_slices(xs->els[i].nam);}
+    free_bytes(xs->els); free_bytes(xs);
+}
+
+void clear_names(struct names *xs)
+{
+    for (size_t i = 0; i < xs->num; i++){free_slices(xs->els[i].nam);}
+    xs->num = 0;
+    xs->cur = 0;
+}
+
+void detach_names(struct names *xs)
+{
+    for (size_t i = 0; i < xs->num; i++){detach_slices(&xs->els[i].nam);}
 }
 
-char *pop_names(struct names *xs)
+//  Pops the most recently pushed name, passing on its ownership. Returns
+//  a `NULL` slice if empty.
+struct slices pop_names(struct names *xs)
 {
-    if (xs->num == 0) {return NULL;}
-    char *res = xs->els[(xs->num) - 1];
+    if (xs->num == 0) {return (struct slices) {.str = NULL};}
+    if (xs->cur == xs->num) {xs->cur = xs->els[xs->num - 1].up;}
     xs->num--;
-    return res;
+    return xs->els[xs->num].nam;
 }
 
-void push_names(struct names *xs, char *x)
+//  Pushes `x` as the innermost binder in scope, taking its ownership.
+//  Callers restore the scope by resetting `cur` to its previous value.
+void push_names(struct names *xs, struct slices x)
 {
-    if (xs->num < xs->cap) {
-       xs->els[xs->num] = x;
-       xs->num++;
-    } else {
-        void *tmp = realloc(xs, (sizeof(xs) * 3)/2 + 8);
+    if (xs->num == xs->cap) {
+        size_t cap = ((xs->cap) * 3)/2 + 8;
+        struct binders *tmp = realloc_bytes(xs->els, sizeof(struct binders) * cap);
         if (!tmp) {
-            free_names(tmp);
+            free_slices(x);
             fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
                           , __LINE__, __FUNCTION__);
             return;
         }
-        xs = tmp;
-        xs->cap = ((xs->cap) * 3)/2 + 8;
-        xs->els[xs->num] = x;
-        xs->num++;
+        xs->els = tmp;
+        xs->cap = cap;
     }
+    xs->els[xs->num] = (struct binders) { .nam = x, .up = xs->cur
+                                         , .lam = NULL };
+    xs->num++;
+    xs->cur = xs->num;
 }
 
-int get_dbidx(char *x, struct names *xs)
+int get_dbidx(struct slices x, struct names *xs)
 {
-    int num = xs->num;
-    if (num == 0) {
-        fprintf(stderr, "Unbound name %s.\n", x);
-    }
-    for (int i = num - 1; i >= 0; i--) {
-        if (!strcmp(x, xs->els[i])) {
-            return num -1 - i;
+    int idx = 0;
+    for (size_t i = xs->cur; i; i = xs->els[i - 1].up, idx++) {
+        if (eq_slices(x, xs->els[i - 1].nam)) {
+            return idx;
         }
     }
-    fprintf(stderr, "Undbound name %s.\n", x);
+    fprintf(stderr, "Unbound name %.*s.\n", (int) x.len, x.str);
     return -1;
 }
 
@@ -233,306 +291,1138 @@ int get_dbidx(char *x, struct names *xs)
 
 //  Translating to/from de Bruijn encoding.
 
-struct terms2 *lam2db(struct terms1 *t, struct names *xs)
+//  Memos of the translations, so that they preserve sharing. What a
+//  node translates to depends only on the names of the binders of its
+//  free variables, i.e., of the `k` innermost binders in scope (see
+//  `struct names`) when its free de Bruijn indexes are `< k`. Shared
+//  nodes (`refcnt > 1`) are memoized with those names, and met again
+//  under binders of the same names, translate to another reference to
+//  the same result. Translating a node once, the translations also push
+//  and pop names for its lambdas once, in the same order.
+
+struct convs {
+    const void *key;
+    void *val;              // Borrowed from the result being built.
+    unsigned int k;
+    struct slices *nams;    // Views of the `k` names, innermost first.
+};
+
+struct convmemos {
+    size_t cap;             // A power of two, or zero.
+    size_t num;
+    struct convs *els;
+};
+
+static void free_convmemos(struct convmemos *m)
+{
+    for (size_t i = 0; i < m->cap; i++) {free_bytes(m->els[i].nams);}
+    free_bytes(m->els);
+}
+
+static size_t hash_convs(const void *key, size_t cap)
+{
+    uint64_t h = (uint64_t) (uintptr_t) key * 0x9e3779b97f4a7c15ull;
+    return (size_t) (h >> 32) & (cap - 1);
+}
+
+static int scope_convs(struct convs *c, struct names *xs)
+{
+    size_t i = xs->cur;
+    for (unsigned int j = 0; j < c->k; j++, i = xs->els[i - 1].up) {
+        if (!i || !eq_slices(c->nams[j], xs->els[i - 1].nam)) {return 0;}
+    }
+    return 1;
+}
+
+//  The translation of `key` in the scope of `xs`, if memoized, setting
+//  `*k`; otherwise `NULL`.
+static void *get_convmemos( struct convmemos *m, const void *key
+                          , struct names *xs, unsigned int *k)
+{
+    if (!m->cap) {return NULL;}
+    size_t i = hash_convs(key, m->cap);
+    for (; m->els[i].key; i = (i + 1) & (m->cap - 1)) {
+        if (m->els[i].key == key && scope_convs(&m->els[i], xs)) {
+            *k = m->els[i].k;
+            return m->els[i].val;
+        }
+    }
+    return NULL;
+}
+
+static void put_convmemos( struct convmemos *m, const void *key, void *val
+                         , struct names *xs, unsigned int k)
+{
+    if (2 * (m->num + 1) > m->cap) {
+        size_t cap = m->cap ? 2 * m->cap : 64;
+        struct convs *els = calloc_bytes(cap, sizeof(struct convs));
+        if (!els) {return;} // Then the result is just not shared.
+        for (size_t i = 0; i < m->cap; i++) {
+            if (!m->els[i].key) {continue;}
+            size_t j = hash_convs(m->els[i].key, cap);
+            while (els[j].key) {j = (j + 1) & (cap - 1);}
+            els[j] = m->els[i];
+        }
+        free_bytes(m->els);
+        m->els = els;
+        m->cap = cap;
+    }
+    struct slices *nams = NULL;
+    if (k) {
+        nams = alloc_bytes(k * sizeof(struct slices));
+        if (!nams) {return;}
+        size_t i = xs->cur;
+        for (unsigned int j = 0; j < k; j++, i = xs->els[i - 1].up) {
+            nams[j] = xs->els[i - 1].nam;
+        }
+    }
+    size_t i = hash_convs(key, m->cap);
+    while (m->els[i].key) {i = (i + 1) & (m->cap - 1);}
+    m->els[i] = (struct convs) {.key = key, .val = val, .k = k, .nams = nams};
+    m->num++;
+}
+
+//  Sets `*k` to the least bound of the free indexes of the result.
+static struct terms2 *lam2db_aux( struct terms1 *t, struct names *xs
+                                , struct convmemos *m, unsigned int *k)
 {
     if (!t) {return NULL;}
     if (t->tag == VAR1) {
         int idx = get_dbidx(t->var, xs);
-        if (idx == -1) {
-            fprintf(stderr, "Unbound name %s.\n", t->var);
-        }
-        struct terms2 *var2 = malloc(sizeof(struct terms2));
-        MALCHECK(var2);
-        *var2 = (struct terms2) {.refcnt = 1, .tag = VAR2, .idx = idx};
-        return var2;
+        if (idx == -1) {return NULL;}
+        *k = idx + 1;
+        return mk_var2(idx);
     }
+    if (t->tag == NUM1) {
+        *k = 0;
+        return mk_num2(t->num);
+    }
+    int shared = t->refcnt > 1;
+    if (shared) {
+        struct terms2 *memo = get_convmemos(m, t, xs, k);
+        if (memo) {incref_terms2(memo); return memo;}
+    }
+    struct terms2 *res;
     if (t->tag == LAM1) {
-        char *x = t->lam->var;
-        push_names(xs, strdup(x));
-        struct terms1 *bod = t->lam->bod;
-        struct terms2 *bod2 = lam2db(bod, xs);
-        struct terms2 *lam2 = malloc(sizeof(struct terms2));
-        MALCHECK(lam2);
-        *lam2 = (struct terms2) {.refcnt = 1, .tag = LAM2, .lam = bod2};
-        return lam2;
-    }
-    // Tag `APP1`.
-    struct terms1 *fun = t->app->fun;
-    struct terms1 *arg = t->app->arg;
-    struct terms2 *fun2 = lam2db(fun, xs);
-    struct terms2 *arg2 = lam2db(arg, xs);
-    struct terms2 *app2 = malloc(sizeof(struct terms2));
-    MALCHECK(app2);
-    struct apps2 *app2_app = malloc(sizeof(struct apps2));
-    MALCHECK(app2_app);
-    app2_app->fun = fun2;
-    app2_app->arg = arg2;
-    app2->refcnt = 1;
-    app2->tag = APP2;
-    app2->app = app2_app;
-    return app2;
+        size_t up = xs->cur, i = xs->num;
+        push_names(xs, dup_slices(t->lam->var));
+        struct terms2 *bod2 = lam2db_aux(t->lam->bod, xs, m, k);
+        xs->cur = up;
+        if (!bod2) {return NULL;}
+        if (*k) {(*k)--;}
+        res = mk_lam2(bod2);
+        if (i < xs->num) {xs->els[i].lam = res;}
+    } else {
+        // Tag `APP1`.
+        unsigned int kfun, karg;
+        struct terms2 *fun2 = lam2db_aux(t->app->fun, xs, m, &kfun);
+        if (!fun2) {return NULL;}
+        struct terms2 *arg2 = lam2db_aux(t->app->arg, xs, m, &karg);
+        if (!arg2) {decref_terms2(fun2); return NULL;}
+        *k = kfun > karg ? kfun : karg;
+        res = mk_app2(fun2, arg2);
+    }
+    if (shared && res) {put_convmemos(m, t, res, xs, *k);}
+    return res;
+}
+
+struct terms2 *lam2db(struct terms1 *t, struct names *xs)
+{
+    struct convmemos m = {0};
+    unsigned int k;
+    struct terms2 *res = lam2db_aux(t, xs, &m, &k);
+    free_convmemos(&m);
+    return res;
 }
 
 struct terms2 *lam2db_nonames(struct terms1 *t)
 {
-    struct names *xs = alloc_names(16);
-    struct terms2 *result = lam2db(t, xs);
-    free_names(xs);
+    struct names xs = {0};
+    struct terms2 *result = lam2db(t, &xs);
+    clear_names(&xs);
+    free_bytes(xs.els);
     return result;
 }
 
 /* ***** ***** */
 
-struct terms1 *db2lam_aux(struct terms2 *t, struct names *xs
-                                          , struct names *tmp)
+//  The stack `tmp` holds the binders in scope, as views of the names
+//  owned by the lambdas being built. Sets `*k` like `lam2db_aux`.
+static struct terms1 *db2lam_aux( struct terms2 *t, struct names *xs
+                                , struct names *tmp
+                                , struct convmemos *m, unsigned int *k)
 {
     if (!t) {return NULL;}
 
-    if (t->tag == VAR2) {
-        int i = tmp->num - 1 - t->idx;
+    if (tag_terms2(t) == VAR2) {
+        int i = tmp->num - 1 - idx_terms2(t);
         if (i >= 0) {
-            struct terms1 *variable = malloc(sizeof(struct terms1));
-            MALCHECK(variable);
-            variable->refcnt = 1;
-            variable->tag = VAR1;
-            variable->var = strdup(tmp->els[i]);
-            return variable;
+            *k = idx_terms2(t) + 1;
+            return mk_var1(dup_slices(tmp->els[i].nam));
         } else {
             fprintf(stderr, "The de Bruijn index %u was an unbound"
-                            "variable. Malformed term.\n", t->idx);
+                            "variable. Malformed term.\n", idx_terms2(t));
             return NULL;
         }
-    } else if (t->tag == LAM2) {
-        char *x = pop_names(xs);
-        MALCHECK(x)
-        push_names(tmp, strdup(x));
-        struct terms2 *t0 = t->lam;
-        struct terms1 *body = db2lam_aux(t0, xs, tmp);
-        MALCHECK(body)
-        struct terms1 *lambda = malloc(sizeof(struct terms1));
-        MALCHECK(lambda);
-        struct lams1 *lambda_lam = malloc(sizeof(struct lams1));
-        MALCHECK(lambda_lam);
-        lambda_lam->var = x;
-        lambda_lam->bod = body;
-        lambda->refcnt = 1;
-        lambda->tag = LAM1;
-        lambda->lam = lambda_lam;
-        return lambda;
-    }
-    struct terms2 *e1 = t->app->fun;
-    struct terms2 *e2 = t->app->arg;
-    struct terms1 *t1 = db2lam_aux(e1, xs, tmp);
-    if (!t1) {return NULL;}
-    struct terms1 *t2 = db2lam_aux(e2, xs, tmp);
-    if (!t2) {return NULL;}
-    struct terms1 *application = malloc(sizeof(struct terms1));
-    MALCHECK(application);
-    struct apps1 *application_app = malloc(sizeof(struct apps1));
-    MALCHECK(application_app);
-    application_app->fun = t1;
-    application_app->arg = t2;
-    application->refcnt = 1;
-    application->tag = APP1;
-    application->app = application_app;
-    return application;
+    } else if (tag_terms2(t) == NUM2) {
+        *k = 0;
+        return mk_num1(num_terms2(t));
+    } else if (tag_terms2(t) == DEF2) {
+        // Left as a reference, for `parse_declterms1` to resolve.
+        *k = 0;
+        return mk_var1(dup_slices(name_def2(t)));
+    }
+    int shared = t->refcnt > 1;
+    if (shared) {
+        struct terms1 *memo = get_convmemos(m, t, tmp, k);
+        if (memo) {incref_terms1(memo); return memo;}
+    }
+    struct terms1 *res;
+    if (tag_terms2(t) == LAM2) {
+        struct slices x = pop_names(xs);
+        if (!x.str) {
+            fprintf(stderr, "Too few names to translate lambda.\n");
+            return NULL;
+        }
+        size_t up = tmp->cur;
+        push_names(tmp, x);
+        struct terms1 *body = db2lam_aux(t->lam, xs, tmp, m, k);
+        tmp->num--;
+        tmp->cur = up;
+        if (!body) {free_slices(x); return NULL;}
+        if (*k) {(*k)--;}
+        res = mk_lam1(x, body);
+    } else {
+        unsigned int kfun, karg;
+        struct terms1 *t1 = db2lam_aux(t->app->fun, xs, tmp, m, &kfun);
+        if (!t1) {return NULL;}
+        struct terms1 *t2 = db2lam_aux(t->app->arg, xs, tmp, m, &karg);
+        if (!t2) {decref_terms1(t1); return NULL;}
+        *k = kfun > karg ? kfun : karg;
+        res = mk_app1(t1, t2);
+    }
+    if (shared && res) {put_convmemos(m, t, res, tmp, *k);}
+    return res;
 }
 
 struct terms1 *db2lam(struct terms2 *t, struct names *xs)
 {
     for (int lo = 0, hi = xs->num - 1; lo < hi; lo++, hi--) {
-        char *s = xs->els[lo];
+        struct binders s = xs->els[lo];
         xs->els[lo] = xs->els[hi];
         xs->els[hi] = s;
     }
+    xs->cur = 0;
     struct names *tmp = alloc_names(16);
-    struct terms1 *res = db2lam_aux(t, xs, tmp);
+    struct convmemos m = {0};
+    unsigned int k;
+    struct terms1 *res = db2lam_aux(t, xs, tmp, &m, &k);
+    free_convmemos(&m);
+    tmp->num = 0; // Only views, owned by `res`.
     free_names(tmp);
     return res;
-} 
+}
 
 
 /* ***** ***** */
 
-//  Parsing utility functions.
+//  Printing de Bruijn terms with names, without building a `terms1`.
+//  The binder in scope at depth `i` is named `str[0..len)` followed by
+//  `suffix` in decimal unless zero; names in scope are kept distinct,
+//  which is all it takes for no variable to be captured.
+//
+//  Names are compared as the text they print as, so that, e.g., `x`
+//  with suffix `1` is `x1`. Those in scope are also chained by hash:
+//  `heads` holds the last pushed of each bucket plus one, and `next`
+//  of each the one pushed before it; as names are popped in the reverse
+//  order, unlinking one is just restoring the head. A fresh name for a
+//  taken `x` is `x` with the least free suffix, found from the counter
+//  of `x`, below which all suffixes are taken.
+//
+//  References to declarations print as the declared names, so those
+//  are taken too: they are pushed first, as `nres` names that do not
+//  count as binders.
+
+struct pnames {
+    const char *str;
+    unsigned int len;
+    unsigned int suffix;
+    uint32_t hash;
+    size_t next;
+};
+
+struct pcounters {
+    const char *str;
+    unsigned int len;
+    unsigned int next;  // Suffixes `1 .. next-1` are all taken.
+};
+
+struct sharings;
+
+//  Hints, the names of the lambdas that the parser made, are looked up
+//  by node: lambdas spliced in from declarations, or made by reduction,
+//  have none.
+struct phints {
+    struct terms2 *lam;
+    struct slices nam;
+};
+
+struct printers {
+    FILE *out;
+    size_t hintcap;     // A power of two, or zero.
+    struct phints *hints;
+    struct sharings *sh; // Subterms printed as declarations, or `NULL`.
+    struct terms2 *top; // The term being printed.
+    size_t cap;
+    size_t num;
+    size_t nres;
+    struct pnames *scope;
+    size_t hcap;        // A power of two, or zero.
+    size_t *heads;
+    size_t ccap;        // A power of two, or zero.
+    size_t cnum;
+    struct pcounters *ctrs;
+    size_t scap;        // A power of two, or zero.
+    size_t snum;
+    struct terms2 **seen; // Shared nodes visited by `reserve_defs`.
+};
 
-//  Returns `0` if it the current char of `inp` is not `chr`, `1` if it is.
-int parse_char(FILE *inp, char chr)
+static void free_printers(struct printers *p)
 {
-    int c = fgetc(inp);
-    if (c == EOF) {
-        fprintf(stderr, "Unexpected EOF during `parse_char`.\n");
+    free_bytes(p->hints);
+    free_bytes(p->scope);
+    free_bytes(p->heads);
+    free_bytes(p->ctrs);
+    free_bytes(p->seen);
+}
+
+static unsigned int ndigits(unsigned int n)
+{
+    unsigned int k = 0;
+    for (; n; n /= 10) {k++;}
+    return k;
+}
+
+//  Whether `a` and `b` print alike. The shorter `str` must be a prefix
+//  of the longer, which then goes on with the leading digits of the
+//  shorter one's suffix.
+static int eq_pnames(struct pnames a, struct pnames b)
+{
+    if (a.len > b.len) {struct pnames c = a; a = b; b = c;}
+    unsigned int nb = ndigits(b.suffix);
+    if (a.len + ndigits(a.suffix) != b.len + nb) {return 0;}
+    if (memcmp(a.str, b.str, a.len)) {return 0;}
+    uint64_t n = 0;
+    for (unsigned int i = a.len; i < b.len; i++) {
+        char c = b.str[i];
+        if (!isdigit((unsigned char) c) || (i == a.len && c == '0')) {
+            return 0;
+        }
+        n = 10 * n + (c - '0');
+    }
+    for (unsigned int i = 0; i < nb; i++) {n *= 10;}
+    return n + b.suffix == a.suffix;
+}
+
+//  FNV hash of the text of `x`.
+static uint32_t hash_pnames(struct pnames x)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned int i = 0; i < x.len; i++) {
+        h = (h ^ (unsigned char) x.str[i]) * 0x100000001b3ull;
+    }
+    unsigned int p = 1;
+    for (unsigned int k = ndigits(x.suffix); k > 1; k--) {p *= 10;}
+    for (; p && x.suffix; p /= 10) {
+        h = (h ^ ('0' + x.suffix / p % 10)) * 0x100000001b3ull;
+    }
+    return (uint32_t) (h ^ h >> 32);
+}
+
+//  Splits off the trailing digits of `str` as the suffix, unless they
+//  would not print back alike (a leading `0`, or too many).
+static struct pnames split_pnames(const char *str, unsigned int len)
+{
+    unsigned int k = len;
+    while (k && isdigit((unsigned char) str[k - 1])) {k--;}
+    struct pnames x = {.str = str, .len = len, .suffix = 0};
+    if (k == len || str[k] == '0' || len - k > 9) {return x;}
+    for (unsigned int i = k; i < len; i++) {
+        x.suffix = 10 * x.suffix + (str[i] - '0');
+    }
+    x.len = k;
+    return x;
+}
+
+static int inscope_pnames(struct printers *p, struct pnames x)
+{
+    if (!p->hcap) {return 0;}
+    for (size_t i = p->heads[x.hash & (p->hcap - 1)]; i; ) {
+        struct pnames *y = &p->scope[i - 1];
+        if (y->hash == x.hash && eq_pnames(*y, x)) {return 1;}
+        i = y->next;
+    }
+    return 0;
+}
+
+//  The counter of the names `str[0..len)` with a suffix.
+static unsigned int *counter_pnames( struct printers *p, const char *str
+                                   , unsigned int len)
+{
+    if (2 * (p->cnum + 1) > p->ccap) {
+        size_t cap = p->ccap ? 2 * p->ccap : 16;
+        struct pcounters *tmp = calloc_bytes(cap, sizeof(struct pcounters));
+        if (!tmp) {
+            fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return NULL;
+        }
+        for (size_t i = 0; i < p->ccap; i++) {
+            struct pcounters c = p->ctrs[i];
+            if (!c.next) {continue;}
+            struct pnames x = {.str = c.str, .len = c.len};
+            size_t j = hash_pnames(x) & (cap - 1);
+            while (tmp[j].next) {j = (j + 1) & (cap - 1);}
+            tmp[j] = c;
+        }
+        free_bytes(p->ctrs);
+        p->ctrs = tmp;
+        p->ccap = cap;
+    }
+    struct pnames x = {.str = str, .len = len};
+    size_t i = hash_pnames(x) & (p->ccap - 1);
+    for (; p->ctrs[i].next; i = (i + 1) & (p->ccap - 1)) {
+        struct pcounters *c = &p->ctrs[i];
+        if (c->len == len && !memcmp(c->str, str, len)) {return &c->next;}
+    }
+    p->ctrs[i] = (struct pcounters) {.str = str, .len = len, .next = 1};
+    p->cnum++;
+    return &p->ctrs[i].next;
+}
+
+//  Rechains the names in scope into `hcap` buckets.
+static int grow_heads(struct printers *p, size_t hcap)
+{
+    size_t *tmp = calloc_bytes(hcap, sizeof(size_t));
+    if (!tmp) {
+        fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
         return 0;
-    } else if (c != chr) {
-        ungetc(c, inp);
-        fprintf(stderr, "Bad char; expected '%c' but got '%c'.\n", chr, c);
+    }
+    free_bytes(p->heads);
+    p->heads = tmp;
+    p->hcap = hcap;
+    for (size_t i = 0; i < p->num; i++) {
+        size_t *h = &p->heads[p->scope[i].hash & (hcap - 1)];
+        p->scope[i].next = *h;
+        *h = i + 1;
+    }
+    return 1;
+}
+
+//  Pushes `x`, which must not be in scope.
+static int add_pnames(struct printers *p, struct pnames x)
+{
+    if (p->num == p->cap) {
+        size_t cap = ((p->cap) * 3)/2 + 8;
+        struct pnames *tmp = realloc_bytes(p->scope, sizeof(struct pnames) * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return 0;
+        }
+        p->scope = tmp;
+        p->cap = cap;
+    }
+    if (p->num >= p->hcap && !grow_heads(p, p->hcap ? 2 * p->hcap : 64)) {
         return 0;
     }
+    size_t *h = &p->heads[x.hash & (p->hcap - 1)];
+    x.next = *h;
+    *h = ++p->num;
+    p->scope[p->num - 1] = x;
     return 1;
 }
 
-//  Returns `0` if it fails, `1` if it succeeds. Expects `buf` to be an
-//  uninitialized (but allocated) string of length `sz`.
-int parse_var(FILE *inp, char* buf, size_t sz)
+static size_t hash_seen(struct terms2 *t, size_t cap)
 {
-    char c = fgetc(inp);
-    if (c == EOF) {
-        fprintf(stderr, "Unexpected EOF during `parse_name`.\n");
+    return (size_t) (((uintptr_t) t * 0x9e3779b97f4a7c15ull) >> 32)
+         & (cap - 1);
+}
+
+//  Indexes the hints of `xs` by their lambdas. Returns `0` on failure.
+static int index_hints(struct printers *p, struct names *xs)
+{
+    size_t n = 0, cap = 16;
+    for (size_t i = 0; xs && i < xs->num; i++) {n += !!xs->els[i].lam;}
+    if (!n) {return 1;}
+    while (cap < 2 * n) {cap *= 2;}
+    p->hints = calloc_bytes(cap, sizeof(struct phints));
+    if (!p->hints) {
+        fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
         return 0;
     }
-    int i = 0;
-    while ((isalnum(c) || c == '_') && i < sz - 1) {
-        buf[i] = c;
-        buf[i+1] = '\0';
-        c = fgetc(inp);
-        if (c == EOF) {
-            fprintf(stderr, "Unexpected EOF during `parse_name`.\n");
+    p->hintcap = cap;
+    for (size_t i = 0; i < xs->num; i++) {
+        struct terms2 *lam = xs->els[i].lam;
+        if (!lam) {continue;}
+        size_t j = hash_seen(lam, cap);
+        while (p->hints[j].lam) {j = (j + 1) & (cap - 1);}
+        p->hints[j] = (struct phints) {.lam = lam, .nam = xs->els[i].nam};
+    }
+    return 1;
+}
+
+static struct phints *find_hints(struct printers *p, struct terms2 *lam)
+{
+    if (!p->hintcap) {return NULL;}
+    size_t j = hash_seen(lam, p->hintcap);
+    for (; p->hints[j].lam; j = (j + 1) & (p->hintcap - 1)) {
+        if (p->hints[j].lam == lam) {return &p->hints[j];}
+    }
+    return NULL;
+}
+
+//  Pushes a name for the binder of `lam`.
+static int push_pnames(struct printers *p, struct terms2 *lam)
+{
+    struct pnames x = {.str = "x", .len = 1, .suffix = 0};
+    struct phints *h = find_hints(p, lam);
+    if (h) {x = split_pnames(h->nam.str, h->nam.len);}
+    x.hash = hash_pnames(x);
+    if (inscope_pnames(p, x)) {
+        unsigned int *next = counter_pnames(p, x.str, x.len);
+        if (!next) {return 0;}
+        for (x.suffix = *next; ; x.suffix++) {
+            x.hash = hash_pnames(x);
+            if (!inscope_pnames(p, x)) {break;}
+        }
+        *next = x.suffix + 1;
+    }
+    return add_pnames(p, x);
+}
+
+//  Adds `t` to the nodes seen. Returns `1` if it was already, `0` if
+//  not, and `-1` on failure.
+static int seen_printers(struct printers *p, struct terms2 *t)
+{
+    if (2 * (p->snum + 1) > p->scap) {
+        size_t cap = p->scap ? 2 * p->scap : 64;
+        struct terms2 **tmp = calloc_bytes(cap, sizeof(struct terms2*));
+        if (!tmp) {
+            fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return -1;
+        }
+        for (size_t i = 0; i < p->scap; i++) {
+            if (!p->seen[i]) {continue;}
+            size_t j = hash_seen(p->seen[i], cap);
+            while (tmp[j]) {j = (j + 1) & (cap - 1);}
+            tmp[j] = p->seen[i];
+        }
+        free_bytes(p->seen);
+        p->seen = tmp;
+        p->scap = cap;
+    }
+    size_t i = hash_seen(t, p->scap);
+    for (; p->seen[i]; i = (i + 1) & (p->scap - 1)) {
+        if (p->seen[i] == t) {return 1;}
+    }
+    p->seen[i] = t;
+    p->snum++;
+    return 0;
+}
+
+//  Takes the names of the declarations that `t` refers to, visiting
+//  shared nodes once. Returns `0` on failure.
+static int reserve_defs(struct printers *p, struct terms2 *t)
+{
+    while (!imm_terms2(t)) {
+        if (t->refcnt != 1) {
+            int r = seen_printers(p, t);
+            if (r) {return r > 0;}
+        }
+        struct pnames x;
+        switch (t->tag) {
+        case DEF2:
+            x = split_pnames(name_def2(t).str, name_def2(t).len);
+            x.hash = hash_pnames(x);
+            return inscope_pnames(p, x) || add_pnames(p, x);
+        case LAM2:
+            t = t->lam;
+            break;
+        case APP2:
+            if (!reserve_defs(p, t->app->fun)) {return 0;}
+            t = t->app->arg;
+            break;
+        default:
+            return 1;
+        }
+    }
+    return 1;
+}
+
+static void pop_pnames(struct printers *p)
+{
+    struct pnames x = p->scope[--p->num];
+    p->heads[x.hash & (p->hcap - 1)] = x.next;
+    if (!x.suffix) {return;}
+    unsigned int *next = counter_pnames(p, x.str, x.len);
+    if (next && x.suffix < *next) {*next = x.suffix;}
+}
+
+static void fputs_pnames(struct pnames x, FILE *out)
+{
+    fwrite(x.str, 1, x.len, out);
+    if (x.suffix) {fputu(x.suffix, out);}
+}
+
+static int fputs_shared(struct sharings *sh, struct terms2 *t, FILE *out);
+
+static void fprintf_named_aux(struct printers *p, struct terms2 *t)
+{
+    FILE *out = p->out;
+    if (p->sh && t != p->top && fputs_shared(p->sh, t, out)) {return;}
+    switch (tag_terms2(t)) {
+    case VAR2:
+        if (idx_terms2(t) < p->num - p->nres) {
+            fputs_pnames(p->scope[p->num - 1 - idx_terms2(t)], out);
+        } else {
+            // Free variable; cannot be printed as a name.
+            putc_unlocked('?', out);
+            fputu(idx_terms2(t) - (p->num - p->nres), out);
+        }
+        break;
+    case NUM2:
+        putc_unlocked('#', out);
+        fputu(num_terms2(t), out);
+        break;
+    case DEF2:
+        fwrite(name_def2(t).str, 1, name_def2(t).len, out);
+        break;
+    case LAM2:
+        if (!push_pnames(p, t)) {return;}
+        putc_unlocked('\\', out);
+        fputs_pnames(p->scope[p->num - 1], out);
+        putc_unlocked('.', out);
+        fprintf_named_aux(p, t->lam);
+        pop_pnames(p);
+        break;
+    case APP2:
+        putc_unlocked('(', out);
+        fprintf_named_aux(p, t->app->fun);
+        putc_unlocked(' ', out);
+        fprintf_named_aux(p, t->app->arg);
+        putc_unlocked(')', out);
+        break;
+    }
+}
+
+void fprintf_named_terms2(FILE *out, struct terms2 *t, struct names *xs)
+{
+    if (!t) {
+        fprintf(out, "`NULL`-term.");
+        return;
+    }
+    struct printers p = {.out = out};
+    if (index_hints(&p, xs) && reserve_defs(&p, t)) {
+        p.nres = p.num;
+        fprintf_named_aux(&p, t);
+    }
+    free_printers(&p);
+}
+
+/* ***** ***** */
+
+//  Printing de Bruijn terms with sharing. The distinct nodes of a term
+//  are hash-consed, children first, into classes of equal subterms, so
+//  that classes are numbered after the classes of their subterms. Going
+//  down from the root, which is numbered last, the number of times each
+//  class would be printed is counted; closed classes printed more than
+//  once are declared instead, and counted once.
+
+//  Classes of subterms smaller than this are printed in place anyway.
+#define SHARED_MIN_SIZE 4
+
+enum {KEY_NODE, KEY_IMM, KEY_LAM, KEY_APP, KEY_NUM, KEY_DEF};
+
+struct shkeys {
+    unsigned int kind;
+    uintptr_t a;
+    uintptr_t b;
+};
+
+//  A table from nodes (`KEY_NODE`) and from the structure of nodes, in
+//  terms of the classes of their children, to classes.
+struct shslots {
+    struct shkeys key;
+    size_t cls; // `0` if the slot is empty.
+};
+
+struct shclasses {
+    struct terms2 *rep;
+    size_t kids[2];
+    unsigned int fv;    // As `free_terms2`.
+    size_t size;        // As a tree, saturating.
+    size_t occ;         // Times printed, saturating.
+    size_t decl;        // `1 +` the number of its declaration, or `0`.
+};
+
+struct sharings {
+    const char *prefix;
+    size_t cap;         // Of `slots`, a power of two, or zero.
+    size_t num;
+    struct shslots *slots;
+    size_t capcls;
+    size_t numcls;      // Classes are numbered from `1`.
+    struct shclasses *cls;
+};
+
+static size_t add_sat(size_t a, size_t b)
+{
+    return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+static size_t hash_shkeys(struct shkeys k, size_t cap)
+{
+    uint64_t h = k.kind;
+    h = (h ^ k.a) * 0xff51afd7ed558ccdULL;
+    h = (h ^ (h >> 29) ^ k.b) * 0x9e3779b97f4a7c15ULL;
+    return (size_t) (h >> 32) & (cap - 1);
+}
+
+static int eq_shkeys(struct shkeys k, struct shkeys l)
+{
+    return k.kind == l.kind && k.a == l.a && k.b == l.b;
+}
+
+//  The slot of `k`, or the empty slot where it belongs.
+static struct shslots *find_sharings(struct sharings *sh, struct shkeys k)
+{
+    size_t i = hash_shkeys(k, sh->cap);
+    while (sh->slots[i].cls && !eq_shkeys(sh->slots[i].key, k)) {
+        i = (i + 1) & (sh->cap - 1);
+    }
+    return &sh->slots[i];
+}
+
+static int grow_sharings(struct sharings *sh)
+{
+    size_t cap = sh->cap ? 2 * sh->cap : 256;
+    struct shslots *old = sh->slots;
+    struct shslots *tmp = calloc_bytes(cap, sizeof(struct shslots));
+    if (!tmp) {
+        fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        return 0;
+    }
+    size_t oldcap = sh->cap;
+    sh->slots = tmp;
+    sh->cap = cap;
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].cls) {*find_sharings(sh, old[i].key) = old[i];}
+    }
+    free_bytes(old);
+    return 1;
+}
+
+//  Maps `k` to the class `cls`, if `k` is new, and returns the class
+//  of `k`, or `0` on failure.
+static size_t add_sharings(struct sharings *sh, struct shkeys k, size_t cls)
+{
+    if (2 * (sh->num + 1) > sh->cap && !grow_sharings(sh)) {return 0;}
+    struct shslots *s = find_sharings(sh, k);
+    if (!s->cls) {
+        *s = (struct shslots) {.key = k, .cls = cls};
+        sh->num++;
+    }
+    return s->cls;
+}
+
+static size_t new_shclasses(struct sharings *sh, struct shclasses c)
+{
+    if (sh->numcls + 1 >= sh->capcls) {
+        size_t cap = ((sh->capcls) * 3)/2 + 8;
+        struct shclasses *tmp = realloc_bytes(sh->cls, sizeof(struct shclasses)
+                                                 * cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
             return 0;
         }
-        i++;
-        if (i == sz - 1) {
-            char c = fgetc(inp);
-            if (isalnum(c) || c == '_') {
-                fprintf(stderr, "Too long variable during `parse_name`.");
-                return 0;
-            } else {
-                ungetc(c, inp);
+        sh->cls = tmp;
+        sh->capcls = cap;
+    }
+    sh->cls[++sh->numcls] = c;
+    return sh->numcls;
+}
+
+//  The class of `t`, visiting each distinct node once. Returns `0` on
+//  failure.
+static size_t classify_terms2(struct sharings *sh, struct terms2 *t)
+{
+    struct shkeys node = {.kind = KEY_NODE, .a = (uintptr_t) t, .b = 0};
+    if (sh->cap && !imm_terms2(t)) {
+        struct shslots *s = find_sharings(sh, node);
+        if (s->cls) {return s->cls;}
+    }
+    struct shclasses c = {.rep = t, .size = 1};
+    struct shkeys k = {.kind = KEY_IMM, .a = (uintptr_t) t, .b = 0};
+    switch (tag_terms2(t)) {
+    case VAR2:
+        c.fv = idx_terms2(t) + 1;
+        break;
+    case NUM2:
+        if (!imm_terms2(t)) {k = (struct shkeys) {KEY_NUM, t->num, 0};}
+        break;
+    case DEF2:
+        k = (struct shkeys) { KEY_DEF, (uintptr_t) t->def->ctx
+                            , t->def->idx };
+        break;
+    case LAM2:
+        c.kids[0] = classify_terms2(sh, t->lam);
+        if (!c.kids[0]) {return 0;}
+        k = (struct shkeys) {KEY_LAM, c.kids[0], 0};
+        c.fv = sh->cls[c.kids[0]].fv ? sh->cls[c.kids[0]].fv - 1 : 0;
+        c.size = add_sat(1, sh->cls[c.kids[0]].size);
+        break;
+    case APP2:
+        c.kids[0] = classify_terms2(sh, t->app->fun);
+        c.kids[1] = c.kids[0] ? classify_terms2(sh, t->app->arg) : 0;
+        if (!c.kids[1]) {return 0;}
+        k = (struct shkeys) {KEY_APP, c.kids[0], c.kids[1]};
+        c.fv = sh->cls[c.kids[0]].fv > sh->cls[c.kids[1]].fv
+             ? sh->cls[c.kids[0]].fv : sh->cls[c.kids[1]].fv;
+        c.size = add_sat(1, add_sat( sh->cls[c.kids[0]].size
+                                   , sh->cls[c.kids[1]].size));
+        break;
+    }
+    if (!sh->cap && !grow_sharings(sh)) {return 0;}
+    struct shslots *s = find_sharings(sh, k);
+    size_t cls = s->cls ? s->cls : new_shclasses(sh, c);
+    if (!cls || !add_sharings(sh, k, cls)) {return 0;}
+    if (!imm_terms2(t) && !add_sharings(sh, node, cls)) {return 0;}
+    return cls;
+}
+
+//  Decides which classes to declare, numbering the declarations in the
+//  order of the classes, i.e., declarations before their uses.
+static void share_classes(struct sharings *sh, size_t root)
+{
+    sh->cls[root].occ = 1;
+    for (size_t i = root; i > 0; i--) {
+        struct shclasses *c = &sh->cls[i];
+        int tag = tag_terms2(c->rep);
+        if ( i != root && c->occ > 1 && !c->fv
+          && c->size >= SHARED_MIN_SIZE && (tag == LAM2 || tag == APP2)) {
+            c->decl = 1;
+        }
+        size_t occ = c->decl ? 1 : c->occ;
+        for (int j = 0; j < 2; j++) {
+            if (c->kids[j]) {
+                sh->cls[c->kids[j]].occ = add_sat( sh->cls[c->kids[j]].occ
+                                                 , occ);
             }
         }
-    }    
-    ungetc(c, inp);
+    }
+    size_t n = 0;
+    for (size_t i = 1; i <= root; i++) {
+        if (sh->cls[i].decl) {sh->cls[i].decl = ++n;}
+    }
+}
+
+static int fputs_shared(struct sharings *sh, struct terms2 *t, FILE *out)
+{
+    if (imm_terms2(t)) {return 0;}
+    struct shkeys node = {.kind = KEY_NODE, .a = (uintptr_t) t, .b = 0};
+    size_t decl = sh->cls[find_sharings(sh, node)->cls].decl;
+    if (!decl) {return 0;}
+    fputs(sh->prefix, out);
+    fputu(decl - 1, out);
     return 1;
 }
 
-//  Advances the current char of `inp` until it is not a white-space.
-void parse_whitespace(FILE *inp)
+void fprintf_shared_terms2(FILE *out, struct terms2 *t, const char *prefix)
 {
-    int c = fgetc(inp);
-    if (isspace(c)) {
-        parse_whitespace(inp);
+    if (!t) {
+        fprintf(out, "`NULL`-term.");
+        return;
+    }
+    struct sharings sh = {.prefix = prefix};
+    size_t root = classify_terms2(&sh, t);
+    if (!root) {
+        fprintf_named_terms2(out, t, NULL);
     } else {
-        ungetc(c, inp);
+        share_classes(&sh, root);
+        struct printers p = {.out = out, .sh = &sh};
+        if (!reserve_defs(&p, t)) {root = 0;}
+        p.nres = p.num;
+        for (size_t i = 1; i < root; i++) {
+            if (!sh.cls[i].decl) {continue;}
+            fputs("@ ", out);
+            fputs(prefix, out);
+            fputu(sh.cls[i].decl - 1, out);
+            fputs(" = ", out);
+            p.top = sh.cls[i].rep;
+            fprintf_named_aux(&p, p.top);
+            putc_unlocked('\n', out);
+        }
+        p.top = t;
+        if (root) {fprintf_named_aux(&p, t);}
+        free_printers(&p);
+    }
+    free_bytes(sh.slots);
+    free_bytes(sh.cls);
+}
+
+
+/* ***** ***** */
+
+//  Sources.
+
+struct sources *alloc_sources(FILE *inp)
+{
+    struct sources *src = alloc_bytes(sizeof(struct sources));
+    MALCHECK(src);
+    size_t cap = 1 << 16;
+    char *buf = alloc_bytes(cap);
+    if (!buf) {free_bytes(src);}
+    MALCHECK(buf);
+    size_t len = 0, n;
+    while ((n = fread(buf + len, 1, cap - len - 1, inp)) > 0) {
+        len += n;
+        if (len + 1 == cap) {
+            char *tmp = realloc_bytes(buf, cap * 2);
+            if (!tmp) {free_bytes(buf); free_bytes(src);}
+            MALCHECK(tmp);
+            buf = tmp;
+            cap *= 2;
+        }
     }
+    buf[len] = '\0';
+    *src = (struct sources) {.buf = buf, .len = len, .pos = 0};
+    return src;
+}
+
+struct sources *alloc_sources_str(const char *str, size_t len)
+{
+    struct sources *src = alloc_bytes(sizeof(struct sources));
+    MALCHECK(src);
+    char *buf = alloc_bytes(len + 1);
+    if (!buf) {free_bytes(src);}
+    MALCHECK(buf);
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    *src = (struct sources) {.buf = buf, .len = len, .pos = 0};
+    return src;
+}
+
+#define SOURCES_CHUNK (1 << 16)
+
+struct sources *open_sources(FILE *inp)
+{
+    struct sources *src = alloc_bytes(sizeof(struct sources));
+    MALCHECK(src);
+    char *buf = alloc_bytes(SOURCES_CHUNK + 1);
+    if (!buf) {free_bytes(src);}
+    MALCHECK(buf);
+    buf[0] = '\0';
+    *src = (struct sources) { .buf = buf, .len = 0, .pos = 0, .inp = inp
+                            , .cap = SOURCES_CHUNK + 1 };
+    return src;
+}
+
+void free_sources(struct sources *src)
+{
+    if (!src) {return;}
+    free_bytes(src->buf); free_bytes(src);
+}
+
+size_t size_sources(struct sources *src)
+{
+    return src->inp ? src->dropped + src->end : src->len;
+}
+
+/* ***** ***** */
+
+//  Parsing utility functions. The source is NUL-terminated, so peeking
+//  at `pos == len` is safe and yields a char that no rule accepts.
+
+static inline int peek_char(struct sources *src)
+{
+    return src->pos < src->len ? (unsigned char) src->buf[src->pos] : EOF;
+}
+
+//  Returns `0` if it the current char of `src` is not `chr`, `1` if it is.
+int parse_char(struct sources *src, char chr)
+{
+    int c = peek_char(src);
+    if (c == EOF) {
+        fprintf(stderr, "Unexpected EOF during `parse_char`.\n");
+        return 0;
+    } else if (c != chr) {
+        fprintf(stderr, "Bad char; expected '%c' but got '%c'.\n", chr, c);
+        return 0;
+    }
+    src->pos++;
+    return 1;
+}
+
+//  Returns `0` if it fails, `1` if it succeeds. On success `x` is set to
+//  a borrowed slice of the source; there is no bound on its length.
+int parse_var(struct sources *src, struct slices *x)
+{
+    const char *buf = src->buf;
+    size_t i = skip_identifier(buf, src->pos, src->len);
+    if (i == src->pos) {
+        int c = peek_char(src);
+        if (c == EOF) {
+            fprintf(stderr, "Unexpected EOF during `parse_var`.\n");
+        } else {
+            fprintf(stderr, "Bad char; expected a variable but got '%c'.\n"
+                          , c);
+        }
+        return 0;
+    }
+    *x = (struct slices) { .str = buf + src->pos
+                         , .len = i - src->pos, .own = 0 };
+    src->pos = i;
+    return 1;
+}
+
+//  Parses the digits of a numeral literal `#digits`, the '#' already
+//  consumed. Returns `0` if it fails, `1` if it succeeds.
+int parse_num(struct sources *src, unsigned long *n)
+{
+    const char *buf = src->buf;
+    size_t i = src->pos;
+    unsigned long acc = 0;
+    for (; i < src->len && buf[i] >= '0' && buf[i] <= '9'; i++) {
+        unsigned long d = buf[i] - '0';
+        if (acc > (~0UL - d) / 10) {
+            fprintf(stderr, "Too large numeral during `parse_num`.\n");
+            return 0;
+        }
+        acc = acc * 10 + d;
+    }
+    if (i == src->pos) {
+        fprintf(stderr, "Expected digits after '#' during `parse_num`.\n");
+        return 0;
+    }
+    src->pos = i;
+    *n = acc;
+    return 1;
+}
+
+//  Advances the current char of `src` until it is not a white-space.
+void parse_whitespace(struct sources *src)
+{
+    src->pos = skip_whitespace(src->buf, src->pos, src->len);
+}
+
+int parse_eof(struct sources *src)
+{
+    parse_whitespace(src);
+    return src->pos >= src->len;
 }
 
 /* ***** ***** */
 
 //  Parsing to canonical encoding.
 
-struct terms1 *parse_terms1(FILE *inp)
+struct terms1 *parse_terms1(struct sources *src)
 {
-    parse_whitespace(inp);
-    char c = fgetc(inp);
+    parse_whitespace(src);
+    int c = peek_char(src);
     if (c == '\\') {
-        char *variable = malloc(sizeof(char) * 16);
-        MALCHECK(variable);
-        if (!parse_var(inp, variable, 16)) {free(variable); return NULL;}
-        if (!parse_char(inp, '.')) {free(variable); return NULL;}
-        struct terms1 *body = parse_terms1(inp);
+        src->pos++;
+        struct slices variable;
+        if (!parse_var(src, &variable)) {return NULL;}
+        if (!parse_char(src, '.')) {return NULL;}
+        struct terms1 *body = parse_terms1(src);
         if (!body) {return NULL;}
-        struct terms1 *lambda = malloc(sizeof(struct terms1));
-        if (!lambda) {return NULL;}
-        struct lams1 *lambda_lam = malloc(sizeof(struct lams1));
-        lambda_lam->var = variable;
-        lambda_lam->bod = body;
-        lambda->refcnt = 1;
-        lambda->tag = LAM1;
-        lambda->lam = lambda_lam;
-        return lambda;
+        return mk_lam1(variable, body);
     }
     if (c == '(') {
-        struct terms1 *function = parse_terms1(inp);
+        src->pos++;
+        struct terms1 *function = parse_terms1(src);
         if (!function) {return NULL;}
-        struct terms1 *argument = parse_terms1(inp);
-        if (!argument) {return NULL;}
-        if (!parse_char(inp, ')')) {
+        struct terms1 *argument = parse_terms1(src);
+        if (!argument) {decref_terms1(function); return NULL;}
+        parse_whitespace(src);
+        if (!parse_char(src, ')')) {
             decref_terms1(function); decref_terms1(argument);
             return NULL;
         }
-        struct terms1 *application = malloc(sizeof(struct terms1));
-        MALCHECK(application);
-        struct apps1 *application_app = malloc(sizeof(struct apps1));
-        MALCHECK(application_app);
-        application_app->fun = function;
-        application_app->arg = argument;
-        application->refcnt = 1;
-        application->tag = APP1;
-        application->app = application_app;
-        return application;
-    }
-    ungetc(c, inp);
-    char *name = malloc(sizeof(char) * 16);
-    MALCHECK(name);
-    if (!parse_var(inp, name, 16)) {free(name); return NULL;}
-    struct terms1 *variable = malloc(sizeof(struct terms1));
-    MALCHECK(variable);
-    variable->refcnt = 1;
-    variable->tag = VAR1;
-    variable->var = name;
-    return variable;
+        return mk_app1(function, argument);
+    }
+    if (c == '#') {
+        src->pos++;
+        unsigned long n;
+        if (!parse_num(src, &n)) {return NULL;}
+        return mk_num1(n);
+    }
+    struct slices name;
+    if (!parse_var(src, &name)) {return NULL;}
+    return mk_var1(name);
 }
 
 /* ***** ***** */
 
 //  Parsing to de Bruijn encoding.
 
-struct terms2 *parse_terms2(FILE *inp, struct names *xs)
+struct terms2 *parse_terms2(struct sources *src, struct names *xs)
 {
-    parse_whitespace(inp);
-    char c = fgetc(inp);
+    parse_whitespace(src);
+    int c = peek_char(src);
     if (c == '\\') {
-        char *variable = malloc(sizeof(char) * 16);
-        MALCHECK(variable);
-        if (!parse_var(inp, variable, 16)) {free(variable); return NULL;}
+        src->pos++;
+        struct slices variable;
+        if (!parse_var(src, &variable)) {return NULL;}
+        if (!parse_char(src, '.')) {return NULL;}
+        size_t up = xs->cur, i = xs->num;
         push_names(xs, variable);
-        if (!parse_char(inp, '.')) {return NULL;}
-        struct terms2 *body = parse_terms2(inp, xs);
+        struct terms2 *body = parse_terms2(src, xs);
+        xs->cur = up;
         if (!body) {return NULL;}
-        struct terms2 *lambda = malloc(sizeof(struct terms2));
-        MALCHECK(lambda);
-        lambda->refcnt = 1;
-        lambda->tag = LAM2;
-        lambda->lam = body;
-        return lambda;
+        struct terms2 *lam = mk_lam2(body);
+        if (i < xs->num) {xs->els[i].lam = lam;}
+        return lam;
     }
     if (c == '(') {
-        struct terms2 *function = parse_terms2(inp, xs);
+        src->pos++;
+        struct terms2 *function = parse_terms2(src, xs);
         if (!function) {return NULL;}
-        struct terms2 *argument = parse_terms2(inp, xs);
-        if (!argument) {return NULL;}
-        if (!parse_char(inp, ')')) {
+        struct terms2 *argument = parse_terms2(src, xs);
+        if (!argument) {decref_terms2(function); return NULL;}
+        parse_whitespace(src);
+        if (!parse_char(src, ')')) {
             decref_terms2(function); decref_terms2(argument);
             return NULL;
         }
-        struct terms2 *application = malloc(sizeof(struct terms2));
-        MALCHECK(application);
-        struct apps2 *application_app = malloc(sizeof(struct apps2));
-        MALCHECK(application_app);
-        application_app->fun = function;
-        application_app->arg = argument;
-        application->refcnt = 1;
-        application->tag = APP2;
-        application->app = application_app;
-        return application;
-    }
-    ungetc(c, inp);
-    char *x = malloc(sizeof(char) * 16);
-    MALCHECK(x);
-    if (!parse_var(inp, x, 16)) {free(x); return NULL;}
-    unsigned int idx = get_dbidx(x, xs);
-    free(x);
-    if (idx == -1) {fprintf(stderr, "Unbound name %s.\n", x);}
-    struct terms2 *var2 = malloc(sizeof(struct terms2));
-    MALCHECK(var2);
-    *var2 = (struct terms2) {.refcnt = 1, .tag = VAR2, .idx = idx};
-    return var2;
-}
-
-struct terms2 *parse_terms2_nonames(FILE *inp)
+        return mk_app2(function, argument);
+    }
+    if (c == '#') {
+        src->pos++;
+        unsigned long n;
+        if (!parse_num(src, &n)) {return NULL;}
+        return mk_num2(n);
+    }
+    struct slices x;
+    if (!parse_var(src, &x)) {return NULL;}
+    int idx = get_dbidx(x, xs);
+    if (idx == -1) {return NULL;}
+    return mk_var2(idx);
+}
+
+struct terms2 *parse_terms2_nonames(struct sources *src)
 {
-    struct names *xs = alloc_names(16);
-    struct terms2 *result = parse_terms2(inp, xs);
-    free_names(xs);
+    // The stack lives here, its array only allocated if a name is bound.
+    struct names xs = {0};
+    struct terms2 *result = parse_terms2(src, &xs);
+    clear_names(&xs);
+    free_bytes(xs.els);
     return result;
 }
 
@@ -540,29 +1430,18 @@ struct terms2 *parse_terms2_nonames(FILE *inp)
 
 //  Contexts.
 
-struct binds1 {
-        char *nam;
-        struct terms1 *trm;
-}; 
-
-struct binds1 mk_binds1(char *name, struct terms1 *term)
+struct binds1 mk_binds1(struct slices name, struct terms1 *term)
 {
     return (struct binds1) {.nam = name, .trm = term};
 }
 
-struct contexts1 {
-    size_t cap;
-    size_t num;
-    struct binds1 *els;
-};
-
 struct contexts1 *alloc_contexts1(size_t cap)
 {
-    struct contexts1 *ctx = malloc(sizeof(struct contexts1));
+    struct contexts1 *ctx = alloc_bytes(sizeof(struct contexts1));
     MALCHECK(ctx);
     ctx->cap = cap;
     ctx->num = 0;
-    struct binds1 *tmp = malloc(sizeof(struct binds1) * cap);
+    struct binds1 *tmp = alloc_bytes(sizeof(struct binds1) * cap);
     MALCHECK(tmp);
     ctx->els = tmp;
     return ctx;
@@ -572,10 +1451,17 @@ void free_contexts1(struct contexts1 *ctx)
 {
     if (!ctx) {return;}
     struct binds1 *els = ctx->els;
-    for (int i = 0; i < ctx->num; i++) {
-        free(els[i].nam); decref_terms1(els[i].trm);
+    for (size_t i = 0; i < ctx->num; i++) {
+        free_slices(els[i].nam); decref_terms1(els[i].trm);
+    }
+    free_bytes(els); free_bytes(ctx);
+}
+
+void detach_contexts1(struct contexts1 *ctx)
+{
+    for (size_t i = 0; i < ctx->num; i++) {
+        detach_slices(&ctx->els[i].nam); detach_terms1(ctx->els[i].trm);
     }
-    free(els); free(ctx);
 }
 
 void push_contexts1(struct contexts1 *ctx, struct binds1 bnd)
@@ -584,25 +1470,25 @@ void push_contexts1(struct contexts1 *ctx, struct binds1 bnd)
        ctx->els[ctx->num] = bnd;
        ctx->num++;
     } else {
-        void *tmp = realloc(ctx, (sizeof(ctx) * 3)/2 + 8);
+        size_t cap = ((ctx->cap) * 3)/2 + 8;
+        struct binds1 *tmp = realloc_bytes(ctx->els, sizeof(struct binds1) * cap);
         if (!tmp) {
-            free_contexts1(tmp);
             fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
                           , __LINE__, __FUNCTION__);
             return;
         }
-        ctx = tmp;
-        ctx->cap = ((ctx->cap) * 3)/2 + 8;
+        ctx->els = tmp;
+        ctx->cap = cap;
         ctx->els[ctx->num] = bnd;
         ctx->num++;
     }
 }
 
-struct terms1 *get_ctxterm1(char *x, struct contexts1 *ctx)
+struct terms1 *get_ctxterm1(struct slices x, struct contexts1 *ctx)
 {
     struct binds1 *els = ctx->els;
-    for (int i = 0; i < ctx->num; i++) {
-        if (!strcmp(x, els[i].nam)) {
+    for (size_t i = 0; i < ctx->num; i++) {
+        if (eq_slices(x, els[i].nam)) {
             incref_terms1(els[i].trm);
             return els[i].trm;
         }
@@ -612,31 +1498,24 @@ struct terms1 *get_ctxterm1(char *x, struct contexts1 *ctx)
 
 //  de Bruijn contexts.
 
-struct binds2 {
-        char *nam;
-        struct terms2 *trm;
-}; 
-
-struct binds2 mk_binds2(char *name, struct terms2 *term)
+struct binds2 mk_binds2(struct slices name, struct terms2 *term)
 {
     return (struct binds2) {.nam = name, .trm = term};
 }
 
-struct contexts2 {
-    size_t cap;
-    size_t num;
-    struct binds2 *els;
-};
-
 struct contexts2 *alloc_contexts2(size_t cap)
 {
-    struct contexts2 *ctx = malloc(sizeof(struct contexts1));
+    struct contexts2 *ctx = alloc_bytes(sizeof(struct contexts2));
     MALCHECK(ctx);
     ctx->cap = cap;
     ctx->num = 0;
-    struct binds2 *tmp = malloc(sizeof(struct binds2) * cap);
+    ctx->vis = SIZE_MAX;
+    ctx->flags = 0;
+    struct binds2 *tmp = alloc_bytes(sizeof(struct binds2) * cap);
     MALCHECK(tmp);
     ctx->els = tmp;
+    ctx->hcap = ctx->hnum = ctx->nindexed = 0;
+    ctx->index = NULL;
     return ctx;
 }
 
@@ -644,10 +1523,30 @@ void free_contexts2(struct contexts2 *ctx)
 {
     if (!ctx) {return;}
     struct binds2 *els = ctx->els;
-    for (int i = 0; i < ctx->num; i++) {
-        free(els[i].nam); decref_terms2(els[i].trm);
+    for (size_t i = 0; i < ctx->num; i++) {
+        free_slices(els[i].nam); decref_terms2(els[i].trm);
+        decref_terms2(els[i].ref); free_slices(els[i].bod);
+    }
+    free_bytes(ctx->index); free_bytes(els); free_bytes(ctx);
+}
+
+void set_flags_contexts2(struct contexts2 *ctx, unsigned int flags)
+{
+    ctx->flags = flags;
+}
+
+//  Detaches the bindings of index `from` and up.
+static void detach_from_contexts2(struct contexts2 *ctx, size_t from)
+{
+    for (size_t i = from; i < ctx->num; i++) {
+        detach_slices(&ctx->els[i].nam);
+        if (!ctx->els[i].trm) {detach_slices(&ctx->els[i].bod);}
     }
-    free(els); free(ctx);
+}
+
+void detach_contexts2(struct contexts2 *ctx)
+{
+    detach_from_contexts2(ctx, 0);
 }
 
 void push_contexts2(struct contexts2 *ctx, struct binds2 bnd)
@@ -656,186 +1555,554 @@ void push_contexts2(struct contexts2 *ctx, struct binds2 bnd)
        ctx->els[ctx->num] = bnd;
        ctx->num++;
     } else {
-        void *tmp = realloc(ctx, (sizeof(ctx) * 3)/2 + 8);
+        size_t cap = ((ctx->cap) * 3)/2 + 8;
+        struct binds2 *tmp = realloc_bytes(ctx->els, sizeof(struct binds2) * cap);
         if (!tmp) {
-            free_contexts1(tmp);
             fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
                           , __LINE__, __FUNCTION__);
             return;
         }
-        ctx = tmp;
-        ctx->cap = ((ctx->cap) * 3)/2 + 8;
+        ctx->els = tmp;
+        ctx->cap = cap;
         ctx->els[ctx->num] = bnd;
         ctx->num++;
     }
 }
 
-struct terms2 *get_ctxterm2(char *x, struct contexts2 *ctx)
+static size_t hash_slices(struct slices x, size_t cap)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned int i = 0; i < x.len; i++) {
+        h = (h ^ (unsigned char) x.str[i]) * 0x100000001b3ull;
+    }
+    return (size_t) (h ^ h >> 32) & (cap - 1);
+}
+
+static void insert_index2(struct contexts2 *ctx, size_t idx)
+{
+    size_t i = hash_slices(ctx->els[idx].nam, ctx->hcap);
+    while (ctx->index[i]) {i = (i + 1) & (ctx->hcap - 1);}
+    ctx->index[i] = idx + 1;
+    ctx->hnum++;
+}
+
+//  Rebuilds the index of the names, dropping stale entries.
+static int grow_index2(struct contexts2 *ctx)
+{
+    size_t hcap = 64;
+    while (hcap < 4 * ctx->num) {hcap *= 2;}
+    unsigned int *index = calloc_bytes(hcap, sizeof(unsigned int));
+    if (!index) {
+        fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        return 0;
+    }
+    free_bytes(ctx->index);
+    ctx->index = index;
+    ctx->hcap = hcap;
+    ctx->hnum = 0;
+    for (size_t j = 0; j < ctx->num; j++) {insert_index2(ctx, j);}
+    ctx->nindexed = ctx->num;
+    return 1;
+}
+
+//  Index of the binding of `x` in scope, or `-1` if there is none.
+//  Names are unique, so the first binding of `x` found is the one.
+static long find_ctx2(struct slices x, struct contexts2 *ctx)
 {
     struct binds2 *els = ctx->els;
-    for (int i = 0; i < ctx->num; i++) {
-        if (!strcmp(x, els[i].nam)) {
-            incref_terms2(els[i].trm);
-            return els[i].trm;
+    if (ctx->nindexed > ctx->num) {ctx->nindexed = ctx->num;}
+    while (ctx->nindexed < ctx->num) {
+        if (2 * (ctx->hnum + 1) <= ctx->hcap) {
+            insert_index2(ctx, ctx->nindexed++);
+        } else if (!grow_index2(ctx)) {
+            break;
         }
     }
-    return NULL;
+    if (ctx->nindexed < ctx->num) {
+        // Out of memory for the index.
+        for (size_t i = 0; i < ctx->num && i < ctx->vis; i++) {
+            if (eq_slices(x, els[i].nam)) {return i;}
+        }
+        return -1;
+    }
+    if (!ctx->hcap) {return -1;}
+    size_t i = hash_slices(x, ctx->hcap);
+    for (; ctx->index[i]; i = (i + 1) & (ctx->hcap - 1)) {
+        size_t j = ctx->index[i] - 1;
+        if (j < ctx->num && eq_slices(x, els[j].nam)) {
+            return j < ctx->vis ? (long) j : -1;
+        }
+    }
+    return -1;
+}
+
+//  Parses the body of the declaration of index `idx`. While profiling,
+//  its nodes are tagged as its own.
+static struct terms2 *parse_body2( struct sources *src, struct names *xs
+                                 , struct contexts2 *ctx, size_t idx)
+{
+    struct profiles *prof = cur_profiles;
+    unsigned int ccs = prof ? enter_ccs_profiles(prof, idx) : 0;
+    struct terms2 *term = parse_declterms2(src, xs, ctx);
+    if (prof) {set_ccs_profiles(prof, ccs);}
+    if (term && (ctx->flags & CTX2_SIMPLIFY)) {
+        struct terms2 *simple = simplify_terms2(term);
+        decref_terms2(term);
+        term = simple;
+    }
+    return term;
+}
+
+//  Parses the pending body of the binding of index `idx` (see
+//  `index_declterms2`). Returns `0` if it fails, `1` if it succeeds.
+static int force_ctx2(struct contexts2 *ctx, size_t idx)
+{
+    struct slices bod = ctx->els[idx].bod;
+    struct sources sub = { .buf = (char*) bod.str, .len = bod.len
+                         , .pos = 0 };
+    struct names *xs = alloc_names(16);
+    if (!xs) {return 0;}
+    size_t vis = ctx->vis;
+    ctx->vis = idx;
+    struct terms2 *term = parse_body2(&sub, xs, ctx, idx);
+    ctx->vis = vis;
+    free_names(xs);
+    if (!term) {
+        struct slices x = ctx->els[idx].nam;
+        fprintf(stderr, "In the declaration of %.*s.\n", (int) x.len, x.str);
+        return 0;
+    }
+    ctx->els[idx].trm = term;
+    ctx->els[idx].bod = (struct slices) {.str = NULL, .len = 0, .own = 0};
+    free_slices(bod);
+    return 1;
+}
+
+//  A new reference to the binding of index `idx`, parsing it first if
+//  pending. Returns `NULL` if that fails.
+static struct terms2 *ref_ctx2(struct contexts2 *ctx, size_t idx)
+{
+    if (!ctx->els[idx].trm && !force_ctx2(ctx, idx)) {return NULL;}
+    struct binds2 *b = &ctx->els[idx];
+    if (!(ctx->flags & CTX2_DEFS)) {
+        incref_terms2(b->trm);
+        return b->trm;
+    }
+    if (!b->ref) {b->ref = mk_def2(ctx, idx);}
+    incref_terms2(b->ref);
+    return b->ref;
+}
+
+struct terms2 *expand_terms2(struct terms2 *t)
+{
+    struct terms2 *bod, *fun, *arg;
+    switch (tag_terms2(t)) {
+    case DEF2:
+        return expand_terms2(unfold_def2(t));
+    case LAM2:
+        bod = expand_terms2(t->lam);
+        if (bod == t->lam) {decref_terms2(bod); break;}
+        return mk_lam2(bod);
+    case APP2:
+        fun = expand_terms2(t->app->fun);
+        arg = expand_terms2(t->app->arg);
+        if (fun == t->app->fun && arg == t->app->arg) {
+            decref_terms2(fun); decref_terms2(arg);
+            break;
+        }
+        return mk_app2(fun, arg);
+    default:
+        break;
+    }
+    incref_terms2(t);
+    return t;
 }
 
 /* ***** ***** */
 
 //  Parsing declarative lambda-terms.
 
-struct terms1 *parse_declterms1(FILE *inp, struct contexts1 *ctx)
+struct terms1 *parse_declterms1(struct sources *src, struct contexts1 *ctx)
 {
-    parse_whitespace(inp);
-    char c = fgetc(inp);
+    parse_whitespace(src);
+    int c = peek_char(src);
     if (c == '\\') {
-        char *variable = malloc(sizeof(char) * 16);
-        MALCHECK(variable);
-        if (!parse_var(inp, variable, 16)) {free(variable); return NULL;}
-        if (!parse_char(inp, '.')) {free(variable); return NULL;}
-        struct terms1 *body = parse_declterms1(inp, ctx);
+        src->pos++;
+        struct slices variable;
+        if (!parse_var(src, &variable)) {return NULL;}
+        if (!parse_char(src, '.')) {return NULL;}
+        struct terms1 *body = parse_declterms1(src, ctx);
         if (!body) {return NULL;}
-        struct terms1 *lambda = malloc(sizeof(struct terms1));
-        if (!lambda) {return NULL;}
-        struct lams1 *lambda_lam = malloc(sizeof(struct lams1));
-        lambda_lam->var = variable;
-        lambda_lam->bod = body;
-        lambda->refcnt = 1;
-        lambda->tag = LAM1;
-        lambda->lam = lambda_lam;
-        return lambda;
+        return mk_lam1(variable, body);
     }
     if (c == '(') {
-        struct terms1 *function = parse_declterms1(inp, ctx);
+        src->pos++;
+        struct terms1 *function = parse_declterms1(src, ctx);
         if (!function) {return NULL;}
-        struct terms1 *argument = parse_declterms1(inp, ctx);
-        if (!argument) {return NULL;}
-        if (!parse_char(inp, ')')) {
+        struct terms1 *argument = parse_declterms1(src, ctx);
+        if (!argument) {decref_terms1(function); return NULL;}
+        parse_whitespace(src);
+        if (!parse_char(src, ')')) {
             decref_terms1(function); decref_terms1(argument);
             return NULL;
         }
-        struct terms1 *application = malloc(sizeof(struct terms1));
-        MALCHECK(application);
-        struct apps1 *application_app = malloc(sizeof(struct apps1));
-        MALCHECK(application_app);
-        application_app->fun = function;
-        application_app->arg = argument;
-        application->refcnt = 1;
-        application->tag = APP1;
-        application->app = application_app;
-        return application;
+        return mk_app1(function, argument);
+    }
+    if (c == '#') {
+        src->pos++;
+        unsigned long n;
+        if (!parse_num(src, &n)) {return NULL;}
+        return mk_num1(n);
     }
     if (c == '@') {
-        parse_whitespace(inp);
-        char *name = malloc(sizeof(char) * 16);
-        MALCHECK(name);
-        if (!parse_var(inp, name, 16)) {free(name); return NULL;}
+        src->pos++;
+        parse_whitespace(src);
+        struct slices name;
+        if (!parse_var(src, &name)) {return NULL;}
         struct terms1 *ctxterm1 = get_ctxterm1(name, ctx);
         if (ctxterm1) {
-            fprintf(stderr, "Variable %s already defined.\n", name);
-            free(name);
+            fprintf(stderr, "Variable %.*s already defined.\n"
+                          , (int) name.len, name.str);
+            decref_terms1(ctxterm1);
+            return NULL;
         }
-        parse_whitespace(inp);
-        parse_char(inp, '=');
-        struct terms1 *term = parse_declterms1(inp, ctx);
-        struct binds1 bnd = {.nam = name, .trm = term}; 
+        parse_whitespace(src);
+        if (!parse_char(src, '=')) {return NULL;}
+        struct terms1 *term = parse_declterms1(src, ctx);
+        if (!term) {return NULL;}
+        struct binds1 bnd = {.nam = name, .trm = term};
         push_contexts1(ctx, bnd);
+        incref_terms1(term);
         return term;
     }
-    ungetc(c, inp);
-    char *name = malloc(sizeof(char) * 16);
-    MALCHECK(name);
-    if (!parse_var(inp, name, 16)) {free(name); return NULL;}
+    struct slices name;
+    if (!parse_var(src, &name)) {return NULL;}
     struct terms1 *ctxterm1 = get_ctxterm1(name, ctx);
     if (!ctxterm1) {
-        struct terms1 *variable = malloc(sizeof(struct terms1));
-        MALCHECK(variable);
-        variable->refcnt = 1;
-        variable->tag = VAR1;
-        variable->var = name;
-        return variable;
-    }
-    free(name);
+        return mk_var1(name);
+    }
     return ctxterm1;
 }
 
-struct terms2 *parse_declterms2(FILE *inp, struct names *xs
-                                         , struct contexts2 *ctx)
+struct terms2 *parse_declterms2(struct sources *src, struct names *xs
+                                                  , struct contexts2 *ctx)
 {
-    parse_whitespace(inp);
-    char c = fgetc(inp);
+    parse_whitespace(src);
+    int c = peek_char(src);
     if (c == '\\') {
-        char *variable = malloc(sizeof(char) * 16);
-        MALCHECK(variable);
-        if (!parse_var(inp, variable, 16)) {free(variable); return NULL;}
+        src->pos++;
+        struct slices variable;
+        if (!parse_var(src, &variable)) {return NULL;}
+        if (!parse_char(src, '.')) {return NULL;}
+        size_t up = xs->cur, i = xs->num;
         push_names(xs, variable);
-        if (!parse_char(inp, '.')) {return NULL;}
-        struct terms2 *body = parse_declterms2(inp, xs, ctx);
+        struct terms2 *body = parse_declterms2(src, xs, ctx);
+        xs->cur = up;
         if (!body) {return NULL;}
-        struct terms2 *lambda = malloc(sizeof(struct terms2));
-        MALCHECK(lambda);
-        lambda->refcnt = 1;
-        lambda->tag = LAM2;
-        lambda->lam = body;
-        return lambda;
+        struct terms2 *lam = mk_lam2(body);
+        if (i < xs->num) {xs->els[i].lam = lam;}
+        return lam;
     }
     if (c == '(') {
-        struct terms2 *function = parse_declterms2(inp, xs, ctx);
+        src->pos++;
+        struct terms2 *function = parse_declterms2(src, xs, ctx);
         if (!function) {return NULL;}
-        struct terms2 *argument = parse_declterms2(inp, xs, ctx);
-        if (!argument) {return NULL;}
-        if (!parse_char(inp, ')')) {
+        struct terms2 *argument = parse_declterms2(src, xs, ctx);
+        if (!argument) {decref_terms2(function); return NULL;}
+        parse_whitespace(src);
+        if (!parse_char(src, ')')) {
             decref_terms2(function); decref_terms2(argument);
             return NULL;
         }
-        struct terms2 *application = malloc(sizeof(struct terms2));
-        MALCHECK(application);
-        struct apps2 *application_app = malloc(sizeof(struct apps2));
-        MALCHECK(application_app);
-        application_app->fun = function;
-        application_app->arg = argument;
-        application->refcnt = 1;
-        application->tag = APP2;
-        application->app = application_app;
-        return application;
+        return mk_app2(function, argument);
+    }
+    if (c == '#') {
+        src->pos++;
+        unsigned long n;
+        if (!parse_num(src, &n)) {return NULL;}
+        return mk_num2(n);
     }
     if (c == '@') {
-        parse_whitespace(inp);
-        char *name = malloc(sizeof(char) * 16);
-        MALCHECK(name);
-        if (!parse_var(inp, name, 16)) {free(name); return NULL;}
-        struct terms2 *ctxterm2 = get_ctxterm2(name, ctx);
-        if (ctxterm2) {
-            fprintf(stderr, "Variable %s already defined.\n", name);
-            free(name);
-        }
-        parse_whitespace(inp);
-        parse_char(inp, '=');
-        struct terms2 *term = parse_declterms2(inp, xs, ctx);
-        struct binds2 bnd = {.nam = name, .trm = term}; 
+        src->pos++;
+        parse_whitespace(src);
+        struct slices name;
+        if (!parse_var(src, &name)) {return NULL;}
+        if (find_ctx2(name, ctx) != -1) {
+            fprintf(stderr, "Variable %.*s already defined.\n"
+                          , (int) name.len, name.str);
+            return NULL;
+        }
+        parse_whitespace(src);
+        if (!parse_char(src, '=')) {return NULL;}
+        struct terms2 *term = parse_body2(src, xs, ctx, ctx->num);
+        if (!term) {return NULL;}
+        struct binds2 bnd = {.nam = name, .trm = term, .ref = NULL};
         push_contexts2(ctx, bnd);
+        incref_terms2(term);
         return term;
     }
-    ungetc(c, inp);
-    char *x = malloc(sizeof(char) * 16);
-    MALCHECK(x);
-    if (!parse_var(inp, x, 16)) {free(x); return NULL;}
-    struct terms2 *ctxterm2 = get_ctxterm2(x, ctx);
-    if (!ctxterm2) {
-        unsigned int idx = get_dbidx(x, xs);
-        free(x);
-        if (idx == -1) {fprintf(stderr, "Unbound name %s.\n", x);}
-        struct terms2 *var2 = malloc(sizeof(struct terms2));
-        MALCHECK(var2);
-        *var2 = (struct terms2) {.refcnt = 1, .tag = VAR2, .idx = idx};
-        return var2;
+    struct slices x;
+    if (!parse_var(src, &x)) {return NULL;}
+    long i = find_ctx2(x, ctx);
+    if (i != -1) {return ref_ctx2(ctx, i);}
+    int idx = get_dbidx(x, xs);
+    if (idx == -1) {return NULL;}
+    return mk_var2(idx);
+}
+
+/* ***** ***** */
+
+//  Lazy loading of declarations.
+
+//  Advances `src` past the term at its current position, without
+//  parsing it: past its lambda binders, and then an atom or up to the
+//  matching parenthesis (see `skip_balanced`). Returns `0` if it fails,
+//  `1` if it succeeds.
+static int skip_term(struct sources *src)
+{
+    const char *buf = src->buf;
+    parse_whitespace(src);
+    while (peek_char(src) == '\\') {
+        size_t i = find_structural(buf, src->pos + 1, src->len);
+        src->pos = i;
+        if (!parse_char(src, '.')) {return 0;}
+        parse_whitespace(src);
+    }
+    if (peek_char(src) != '(') {
+        if (peek_char(src) == '#') {src->pos++;}
+        struct slices x;
+        return parse_var(src, &x);
     }
-    free(x);
-    return ctxterm2;
+    src->pos = skip_balanced(buf, src->pos, src->len);
+    return parse_char(src, ')');
 }
 
+long index_declterms2(struct sources *src, struct contexts2 *ctx)
+{
+    long n = 0;
+    while (!parse_eof(src) && peek_char(src) == '@') {
+        src->pos++;
+        parse_whitespace(src);
+        struct slices name;
+        if (!parse_var(src, &name)) {return -1;}
+        if (find_ctx2(name, ctx) != -1) {
+            fprintf(stderr, "Variable %.*s already defined.\n"
+                          , (int) name.len, name.str);
+            return -1;
+        }
+        parse_whitespace(src);
+        if (!parse_char(src, '=')) {return -1;}
+        parse_whitespace(src);
+        size_t pos = src->pos;
+        if (!skip_term(src)) {return -1;}
+        struct slices bod = { .str = src->buf + pos
+                            , .len = src->pos - pos, .own = 0 };
+        struct binds2 bnd = { .nam = name, .trm = NULL, .ref = NULL
+                            , .bod = bod };
+        push_contexts2(ctx, bnd);
+        n++;
+    }
+    return n;
+}
+
+/* ***** ***** */
+
+//  Streaming. The input is scanned for where declarations end, as by
+//  `skip_term`, but quietly: a declaration running up to the end of
+//  what has been read may go on in what has not (even an identifier,
+//  so one must be followed by some other char). One that goes wrong
+//  ends at the first bad char, for the parser to report it.
+
+//  The end of the parenthesized term at `pos`, counting all parentheses
+//  (`skip_balanced` stops at the declarations in it), or `len`.
+static size_t end_balanced(const char *buf, size_t pos, size_t len)
+{
+    size_t i = skip_balanced(buf, pos, len);
+    if (i == len || buf[i] == ')') {return i;}
+    size_t depth = 0;
+    for (i = pos; i < len; i++) {
+        if (buf[i] == '(') {depth++;}
+        if (buf[i] == ')' && !--depth) {return i;}
+    }
+    return len;
+}
+
+//  The end of the declaration at `pos`, or `0` if it is incomplete.
+static size_t end_declterms(const char *buf, size_t pos, size_t len)
+{
+    for (;;) {
+        char sep;
+        pos = skip_whitespace(buf, pos, len);
+        if (pos < len && buf[pos] == '\\') {
+            pos = find_structural(buf, pos + 1, len);
+            sep = '.';
+        } else if (pos < len && buf[pos] == '@') {
+            pos = skip_whitespace(buf, pos + 1, len);
+            pos = skip_whitespace(buf, skip_identifier(buf, pos, len), len);
+            sep = '=';
+        } else {
+            break;
+        }
+        if (pos == len) {return 0;}
+        if (buf[pos] != sep) {return pos + 1;}
+        pos++;
+    }
+    if (pos == len) {return 0;}
+    if (buf[pos] == '(') {
+        pos = end_balanced(buf, pos, len);
+        return pos < len ? pos + 1 : 0;
+    }
+    size_t i = skip_identifier(buf, pos + (buf[pos] == '#'), len);
+    if (i == len) {return 0;}
+    return i > pos ? i : pos + 1;
+}
 
+//  Detaches the bindings of `ctx` borrowing from `src`, the last ones.
+static void detach_sources(struct sources *src, struct contexts2 *ctx)
+{
+    uintptr_t lo = (uintptr_t) src->buf, hi = lo + src->cap;
+    size_t i = ctx->num;
+    while (i && !ctx->els[i - 1].nam.own
+              && (uintptr_t) ctx->els[i - 1].nam.str - lo < hi - lo) {
+        i--;
+    }
+    detach_from_contexts2(ctx, i);
+}
 
+//  Reads at least as much as is held already, so that a declaration is
+//  rescanned a bounded number of times however long it is.
+static int read_sources(struct sources *src)
+{
+    size_t want = src->end > SOURCES_CHUNK ? src->end : SOURCES_CHUNK;
+    if (src->end + want + 1 > src->cap) {
+        char *tmp = realloc_bytes(src->buf, src->end + want + 1);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return 0;
+        }
+        src->buf = tmp;
+        src->cap = src->end + want + 1;
+    }
+    ssize_t n;
+    do {
+        n = read(fileno(src->inp), src->buf + src->end, want);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {perror("read"); return 0;}
+    src->end += n;
+    src->eof = n == 0;
+    return 1;
+}
 
+int next_sources(struct sources *src, struct contexts2 *ctx)
+{
+    if (!src->inp) {return 0;}
+    src->buf[src->len] = src->held;
+    detach_sources(src, ctx);
+    memmove(src->buf, src->buf + src->pos, src->end - src->pos);
+    src->dropped += src->pos;
+    src->end -= src->pos;
+    src->len = src->pos = 0;
+    size_t to = 0, e;
+    for (;;) {
+        while ((e = end_declterms(src->buf, to, src->end))) {to = e;}
+        if (to || src->eof) {break;}
+        if (!read_sources(src)) {return -1;}
+    }
+    src->len = src->eof ? src->end : to;
+    src->held = src->len < src->end ? src->buf[src->len] : '\0';
+    src->buf[src->len] = '\0';
+    return !parse_eof(src);
+}
+
+/* ***** ***** */
+
+//  Parser sessions. The source is a buffer reused, and grown as needed,
+//  by every call, so the bindings made by a call are detached from it
+//  before returning; `ndetached` counts those that already are.
+
+struct parsers {
+    struct allocators mem;
+    const struct allocators *use;   // `&mem`, or `NULL` for `malloc`.
+    struct sources src;
+    size_t cap;                     // Allocated chars of `src.buf`.
+    size_t ndetached;
+    struct names *xs;
+    struct contexts2 *ctx;
+};
+
+struct parsers *alloc_parsers(const struct allocators *a)
+{
+    const struct allocators *prev = use_allocators(a);
+    struct parsers *p = alloc_bytes(sizeof(struct parsers));
+    if (p) {
+        *p = (struct parsers) {.mem = a ? *a : (struct allocators) {0}};
+        p->use = a ? &p->mem : NULL;
+        p->xs = alloc_names(16);
+        p->ctx = p->xs ? alloc_contexts2(64) : NULL;
+        if (!p->ctx) {
+            if (p->xs) {free_names(p->xs);}
+            free_bytes(p);
+            p = NULL;
+        }
+    }
+    use_allocators(prev);
+    MALCHECK(p);
+    return p;
+}
+
+void free_parsers(struct parsers *p)
+{
+    if (!p) {return;}
+    const struct allocators *prev = use_allocators(p->use);
+    free_names(p->xs);
+    free_contexts2(p->ctx);
+    free_bytes(p->src.buf);
+    free_bytes(p);
+    use_allocators(prev);
+}
+
+struct names *names_parsers(struct parsers *p)
+{
+    return p->xs;
+}
+
+struct contexts2 *contexts_parsers(struct parsers *p)
+{
+    return p->ctx;
+}
+
+struct terms2 *parse_parsers(struct parsers *p, const char *str, size_t len)
+{
+    const struct allocators *prev = use_allocators(p->use);
+    clear_names(p->xs);
+    if (len + 1 > p->cap) {
+        size_t cap = ((p->cap) * 3)/2 + 8;
+        if (cap < len + 1) {cap = len + 1;}
+        char *tmp = realloc_bytes(p->src.buf, cap);
+        if (!tmp) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            use_allocators(prev);
+            return NULL;
+        }
+        p->src.buf = tmp;
+        p->cap = cap;
+    }
+    memcpy(p->src.buf, str, len);
+    p->src.buf[len] = '\0';
+    p->src.len = len;
+    p->src.pos = 0;
+    struct terms2 *t = NULL;
+    while (!parse_eof(&p->src)) {
+        decref_terms2(t);
+        clear_names(p->xs);
+        if (!(t = parse_declterms2(&p->src, p->xs, p->ctx))) {break;}
+    }
+    if (p->ndetached > p->ctx->num) {p->ndetached = p->ctx->num;}
+    detach_from_contexts2(p->ctx, p->ndetached);
+    p->ndetached = p->ctx->num;
+    use_allocators(prev);
+    return t;
+}
@@ -8,14 +8,19 @@
  * \notes   A small library to parse lambda calculus, both into a more
  *          canonical abstract syntax tree presentation and into the de
  *          Bruijn-coded abstract syntax trees, reading lambda "source
- *          code" from a filepointer. Source syntax is as follows:
+ *          code" read into memory (e.g., from a filepointer). Source
+ *          syntax is as follows:
  *
- *          Variables:    Strings of < 16 chars. Legit chars are either
- *                        alpha-numeric or '_'.
+ *          Variables:    Non-empty strings of any length. Legit chars
+ *                        are either alpha-numeric or '_'.
  *          Lambdas:      "\x.term" where "x" is a variable and "term"
  *                        is another lambda-expression.
  *          Applications: "(fun arg)" where "fun" and "arg" are terms.
  *                        The parentheses are mandatory.
+ *          Numerals:     "#n" where "n" is a decimal natural number;
+ *                        short for the Church numeral "\f.\x.(f .. (f
+ *                        x))" with "n" applications, but stored as one
+ *                        node, expanded only when applied.
  *
  *          Additionally, we extend the lambda-calculus with a define
  *          macro, with syntax
@@ -43,6 +48,81 @@
 /* ***** ***** */
 
 
+/**********************************************************************/
+/*          SOURCES AND IDENTIFIERS                                   */
+/**********************************************************************/
+
+/**
+ * \brief   Input retained in memory while it is parsed. Identifiers in
+ *          parsed terms, names and contexts are slices of it rather
+ *          than copies, so a source must outlive them unless they are
+ *          detached (see `detach_terms1` etc.).
+ */
+struct sources;
+
+/**
+ * \brief   Reads the rest of `inp` into a new source.
+ */
+struct sources *alloc_sources(FILE *inp);
+
+/**
+ * \brief   A new source that reads `inp` as it is parsed, a window of
+ *          declarations at a time (see `next_sources`), rather than all
+ *          at once. `inp` must stay open until the source is freed.
+ */
+struct sources *open_sources(FILE *inp);
+
+/**
+ * \brief   A new source holding a copy of the `len` chars at `str`.
+ */
+struct sources *alloc_sources_str(const char *str, size_t len);
+
+void free_sources(struct sources *src);
+
+/**
+ * \brief   Number of chars in the source (read so far, for one from
+ *          `open_sources`).
+ */
+size_t size_sources(struct sources *src);
+
+/**
+ * \brief   Identifiers: `len` chars at `str`, which are either borrowed
+ *          from a source (`own == 0`) or a heap copy owned by whatever
+ *          holds the slice.
+ */
+struct slices {
+    const char *str;
+    unsigned int len;
+    unsigned int own;
+};
+
+
+/**********************************************************************/
+/*          ALLOCATION                                                */
+/**********************************************************************/
+
+/**
+ * \brief   Allocation callbacks, e.g. of a pool per request or a cache
+ *          per thread, each passed `env`. They follow `malloc`, `realloc`
+ *          and `free`, but `realloc` and `free` are never passed `NULL`.
+ */
+struct allocators {
+    void *(*alloc)(void *env, size_t size);
+    void *(*realloc)(void *env, void *ptr, size_t size);
+    void (*free)(void *env, void *ptr);
+    void *env;
+};
+
+/**
+ * \brief   Makes `a` the allocators that the calling thread allocates
+ *          and frees terms (unless in a heap, see `heap.h`), sources,
+ *          names and contexts with, or, if `NULL`, goes back to `malloc`
+ *          and `free`. Returns the ones previously in use. Anything must
+ *          be freed with the allocators it was allocated with in use.
+ */
+const struct allocators *use_allocators(const struct allocators *a);
+
+
 /**********************************************************************/
 /*          CANONICAL AST TYPE                                        */
 /**********************************************************************/
@@ -61,6 +141,12 @@ void decref_terms1(struct terms1 *t0);
 
 void incref_terms1(struct terms1 *t0);
 
+/**
+ * \brief   Replaces all identifiers in the AST borrowed from a source by
+ *          owned copies, so that it may outlive the source.
+ */
+void detach_terms1(struct terms1 *t0);
+
 /**
  * \brief   Pretty-prints the AST, returning it to lambda source code.
  */
@@ -81,7 +167,7 @@ struct terms2;
  */
 void decref_terms2(struct terms2 *t0);
 
-void inccref_terms2(struct terms2 *t0);
+void incref_terms2(struct terms2 *t0);
 
 /**
  * \brief   Pretty-prints the AST (in textual de Bruijn form).
@@ -95,7 +181,7 @@ void fprintf_terms2(FILE *out, struct terms2 *t0);
 /*********************************************************************/
 
 /**
- * \brief   Stacks backed by dynamical arrays of char-pointers. Used to
+ * \brief   Stacks backed by dynamical arrays of identifiers. Used to
  *          store lambda-bindings of variable names.
  */
 struct names;
@@ -111,12 +197,24 @@ struct names *alloc_names(size_t cap);
  */
 void free_names(struct names *xs);
 
+/**
+ * \brief   Frees all variables stored in `xs`, leaving it empty but
+ *          with its capacity, for reuse.
+ */
+void clear_names(struct names *xs);
+
+/**
+ * \brief   Copies the names in `xs` borrowed from a source, so that it
+ *          may outlive the source.
+ */
+void detach_names(struct names *xs);
+
 /**
  * \brief   Gets the de Bruijn index of the variable `x` with respect
- *          to the context `xs`: this is just the depth of `x` in the
- *          stack `xs` -- if `x` is unbound we return `-1`.
+ *          to the context `xs`: this is just the depth of `x` among the
+ *          binders of `xs` in scope -- if `x` is unbound we return `-1`.
  */
-int get_dbidx(char *x, struct names *xs);
+int get_dbidx(struct slices x, struct names *xs);
 
 
 /**********************************************************************/
@@ -126,13 +224,19 @@ int get_dbidx(char *x, struct names *xs);
 /**
  * \brief   Typically called with an empty stack `xs` of names, in case
  *          it stores all the lambda-bound variables of the term in `xs`
- *          after it returns. Frees neither argument.
+ *          after it returns. Frees neither argument. Shared nodes of `t`
+ *          (e.g., declarations spliced in by `parse_declterms1`) are
+ *          translated once per scope of their free variables, and so
+ *          stay shared in the result: time and memory are proportional
+ *          to the nodes of `t` rather than to its size as a tree. Their
+ *          lambdas then only store their variables once in `xs`.
  */
 struct terms2 *lam2db(struct terms1 *t, struct names *xs);
 
 /**
- * \brief   Convenience wrapper of `lam2db`, allocating an empty stack
- *          of bound variable names which it frees before returning.
+ * \brief   Convenience wrapper of `lam2db`, with an empty stack of bound
+ *          variable names of its own, freed before returning. To reuse
+ *          one across calls, see `struct parsers`.
  */
 struct terms2 *lam2db_nonames(struct terms1 *t);
 
@@ -140,10 +244,34 @@ struct terms2 *lam2db_nonames(struct terms1 *t);
  * \brief   Replaces de Bruijn indexes by named variables, using the
  *          given stack of names as a dictionary, and translates all
  *          lambdas and applications accordingly. Note that it reverses
- *          the stack of names.
+ *          the stack of names. References to declarations become
+ *          variables named after them. Sharing is preserved as by
+ *          `lam2db`, so the names it stored fit.
  */
 struct terms1 *db2lam(struct terms2 *t, struct names *xs);
 
+/**
+ * \brief   Pretty-prints `t` as named lambda source code directly, in
+ *          one pass and without allocating a `terms1`. The names of `xs`
+ *          (e.g. as left by `parse_terms2`, in the order they were
+ *          pushed) are used for the lambdas as far as they go; missing or
+ *          clashing names are replaced by fresh ones, so that no variable
+ *          is captured. `xs` may be `NULL` and is not modified.
+ */
+void fprintf_named_terms2(FILE *out, struct terms2 *t, struct names *xs);
+
+/**
+ * \brief   Pretty-prints `t` as named lambda source code, like
+ *          `fprintf_named_terms2`, but each closed subterm that would
+ *          be printed more than once (being shared, or just equal) is
+ *          printed once, as a declaration `@ prefixN = ...` on a line of
+ *          its own, and then referred to by name. The declarations are
+ *          followed by the term itself, so that the output parses back
+ *          to (a term equal to) `t` with `parse_declterms2`, but may be
+ *          exponentially smaller than `t` printed as a tree.
+ */
+void fprintf_shared_terms2(FILE *out, struct terms2 *t, const char *prefix);
+
 
 /*********************************************************************/
 /*          PARSING LAMBDA-TERMS                                     */
@@ -153,22 +281,36 @@ struct terms1 *db2lam(struct terms2 *t, struct names *xs);
  * \brief   Parses a closed term from input. Returns `NULL` in case of
  *          failure.
  */
-struct terms1 *parse_terms1(FILE *inp);
+struct terms1 *parse_terms1(struct sources *src);
 
 /**
  * \brief   Like `parse_terms1` but de Bruijn-encodes the term while it
  *          is parsing. More efficient than first using `parse_terms1`
  *          and then `lam2db`.
  */
-struct terms2 *parse_terms2(FILE *inp, struct names *xs);
+struct terms2 *parse_terms2(struct sources *src, struct names *xs);
 
 /**
  * \brief   Convenience wrapper. Note that in order to, e.g., pretty
  *          print results we need to keep the `names` around (in order
  *          to be able to translate back from the de Bruijn encoding)
- *          which this function doesn't.
+ *          which this function doesn't. To parse many terms, see
+ *          `struct parsers`.
  */
-struct terms2 *parse_terms2_nonames(FILE *inp);
+struct terms2 *parse_terms2_nonames(struct sources *src);
+
+/**
+ * \brief   Parses the digits of a numeral literal `#n` (the '#' being
+ *          consumed already) into `n`. Returns `0` if it fails, `1` if
+ *          it succeeds.
+ */
+int parse_num(struct sources *src, unsigned long *n);
+
+/**
+ * \brief   Skips white-space and returns `1` if the input is exhausted,
+ *          `0` otherwise.
+ */
+int parse_eof(struct sources *src);
 
 
 /*********************************************************************/
@@ -187,15 +329,120 @@ struct contexts2;
 struct contexts2 *alloc_contexts2(size_t cap);
 void free_contexts2(struct contexts2 *ctx);
 
+/**
+ * \brief   Options of a `contexts2`, all off by default:
+ *          `CTX2_DEFS`: `parse_declterms2` turns references to declared
+ *          names into nodes referring to the declaration, printed as its
+ *          name, rather than splicing in the declared term. They are
+ *          unfolded by reduction or by `expand_terms2` only, and must be
+ *          freed before the context.
+ *          `CTX2_SIMPLIFY`: `parse_declterms2` partially evaluates the
+ *          declared terms (see `simplify_terms2`) before storing them,
+ *          so that the administrative redexes of a prelude are reduced
+ *          once rather than at every use.
+ */
+enum {CTX2_DEFS = 1, CTX2_SIMPLIFY = 2};
+void set_flags_contexts2(struct contexts2 *ctx, unsigned int flags);
+
+/**
+ * \brief   Unfolds all references to declarations in `t` (see
+ *          `CTX2_DEFS`), recursively. Returns a new reference; subterms
+ *          without references are shared with `t`.
+ */
+struct terms2 *expand_terms2(struct terms2 *t);
+
+/**
+ * \brief   Copies the names (and, for `contexts1`, the terms' names)
+ *          borrowed from a source, so that the context may outlive it.
+ */
+void detach_contexts1(struct contexts1 *ctx);
+void detach_contexts2(struct contexts2 *ctx);
+
+/**
+ * \brief   Drops the window of a source from `open_sources`, once it is
+ *          parsed, detaching the bindings of `ctx` that borrow from it,
+ *          and reads until the next window holds a complete declaration
+ *          or the input ends. Returns `1` if there is a declaration to
+ *          parse, `0` at the end of the input (or for other sources)
+ *          and `-1` on failure.
+ */
+int next_sources(struct sources *src, struct contexts2 *ctx);
+
 
 /**
  * \brief   Parses one declared closed term from input. Returns `NULL`
- *          in case of failure.
+ *          in case of failure. The result is a new reference, also for
+ *          declarations `@ name = term` (whose `term` is additionally
+ *          stored in the context).
  */
-struct terms1 *parse_declterms1(FILE *inp, struct contexts1 *ctx);
+struct terms1 *parse_declterms1(struct sources *src, struct contexts1 *ctx);
 
-struct terms2 *parse_declterms2(FILE *inp, struct names *xs
-                                         , struct contexts2 *ctx);
+struct terms2 *parse_declterms2(struct sources *src, struct names *xs
+                                                  , struct contexts2 *ctx);
+
+/**
+ * \brief   Indexes the declarations `@ name = term` from the current
+ *          position of `src` on, up to the first term that is not one,
+ *          without parsing them: the extent of each `term` is found by
+ *          counting parentheses, and it is stored in `ctx` as its source.
+ *          A declaration is parsed (and simplified, with `CTX2_SIMPLIFY`)
+ *          when first referred to by a term that `parse_declterms2` is
+ *          parsing, and so, recursively, are the declarations it refers
+ *          to; declarations that nothing refers to are never parsed. A
+ *          declaration that fails to parse makes the term referring to
+ *          it fail instead. Returns the number of declarations indexed,
+ *          or `-1` on error. Until they are parsed, the declarations
+ *          borrow their source, like names, unless detached.
+ */
+long index_declterms2(struct sources *src, struct contexts2 *ctx);
+
+
+/*********************************************************************/
+/*          PARSER SESSIONS                                          */
+/*********************************************************************/
+
+/**
+ * \brief   Scratch state reused across any number of parses, e.g. by a
+ *          service embedding the library: a context of declarations, a
+ *          stack of names and a source buffer, so that a parse sets up
+ *          nothing but grows them as needed. All of it, and the terms
+ *          parsed, are allocated with the allocators of the session.
+ *          A session must be used by one thread at a time.
+ */
+struct parsers;
+
+/**
+ * \brief   Allocates a session with an empty context, allocating with
+ *          (a copy of) `a`, or `malloc` and `free` if `NULL`.
+ */
+struct parsers *alloc_parsers(const struct allocators *a);
+
+/**
+ * \brief   Frees the session, and its context and names.
+ */
+void free_parsers(struct parsers *p);
+
+/**
+ * \brief   Parses the `len` chars at `str` as declarations, like
+ *          `parse_declterms2`, the names declared being added to the
+ *          context of `p` for the parses to come. Returns (a new
+ *          reference to) the last term, or `NULL` in case of failure or
+ *          if there is none; declarations before a failure are kept.
+ *          `str` is copied and may be freed after the call. The term
+ *          must be freed with the allocators of `p` in use (see
+ *          `use_allocators`), before `p` is if it refers to declarations
+ *          (see `CTX2_DEFS`).
+ */
+struct terms2 *parse_parsers(struct parsers *p, const char *str, size_t len);
+
+/**
+ * \brief   The names bound by the term returned last by `parse_parsers`,
+ *          e.g. for `fprintf_named_terms2`, valid until the next call,
+ *          and the context of the session, e.g. to set its flags or to
+ *          reduce the terms with `gmachine.h`.
+ */
+struct names *names_parsers(struct parsers *p);
+struct contexts2 *contexts_parsers(struct parsers *p);
 
 /* ***** ***** */
 
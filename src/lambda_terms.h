@@ -0,0 +1,499 @@
+/**
+ *          ╔════════════════╗
+ *          ║ TERM INTERNALS ║
+ *          ╚════════════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Concrete layouts of the types that `lambda_parser.h` only
+ *          declares, shared by the modules of the library that need to
+ *          pattern match on terms. Not part of the public interface.
+ */
+
+/* ***** ***** */
+
+#ifndef LAMBDA_TERMS_H
+#define LAMBDA_TERMS_H
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "basics.h"
+#include "lambda_parser.h"
+#include "heap.h"
+#include "profile.h"
+
+/* ***** ***** */
+
+//  Retained input: the whole source, NUL-terminated, and a cursor. A
+//  source from `open_sources` holds only the window `buf[0..len)` of
+//  the complete declarations read and not yet dropped, followed by the
+//  chars read past them up to `end`, the one at `len` kept in `held`
+//  while the NUL takes its place.
+
+struct sources {
+    char *buf;
+    size_t len;
+    size_t pos;
+    FILE *inp;      // Read from as parsed, or `NULL`.
+    size_t cap;
+    size_t end;
+    size_t dropped; // Chars dropped before `buf`.
+    int eof;
+    char held;
+};
+
+//  The obvious AST encoding.
+
+struct terms1 {
+    unsigned int refcnt;
+    enum {VAR1, LAM1, APP1, NUM1} tag;
+    union {
+        struct slices var;
+        unsigned long num;
+        struct lams1 {struct slices var; struct terms1 *bod;} *lam;
+        struct apps1 {struct terms1 *fun; struct terms1 *arg;} *app;
+    };
+};
+
+//  de Bruijn AST type. Variables, and numerals up to `IMM2_MAX`, are
+//  not allocated but stored in the pointer itself, as `idx << 2 | 1`
+//  and `num << 2 | 3` respectively; see `mk_var2` and `tag_terms2`.
+//  Pointers to nodes are (at least) 4-aligned, so the two cannot be
+//  confused. Everything but the constructors and accessors below must
+//  treat a `struct terms2 *` as possibly immediate.
+//
+//  Nodes allocated in a heap (see `heap.h`) have `refcnt == 0`, and
+//  their `apps2` or `defs2` right after them; `fwd` is only used by
+//  the collector. `ccs` is the cost centre stack of the node when it was
+//  built while profiling (see `profile.h`), and `0` otherwise.
+//
+//  `fv` and `hash` summarize the term a node is the root of, as
+//  `free_terms2` and `hash_terms2`, so that neither walks it: they are
+//  set by the constructors, and by rewrites in place through
+//  `summarize_terms2`.
+
+struct terms2 {
+    unsigned int refcnt;
+    enum {VAR2, LAM2, APP2, NUM2, DEF2} tag : 8;
+    unsigned int ccs : 24;
+    union {
+        unsigned long num; // Church numeral, expanded on demand.
+        struct terms2 *lam;
+        struct apps2 {struct terms2 *fun; struct terms2 *arg;} *app;
+        struct defs2 {struct contexts2 *ctx; size_t idx;} *def;
+        struct terms2 *fwd;
+    };
+    unsigned int fv;
+    uint32_t hash;
+};
+
+//  Names (arrays of bound variables). Binders are stored in the order
+//  they are pushed, which `db2lam` relies on, while `up` links each to
+//  the binder enclosing it: the names in scope are those on the chain
+//  starting at `cur`. Indexes into `els` are off by one so that `0` can
+//  mean "none". The parsers record the lambda they make for a binder in
+//  `lam`, by which the named printers find the name to reuse.
+
+struct binders {
+    struct slices nam;
+    size_t up;
+    struct terms2 *lam;
+};
+
+struct names {
+    size_t cap; // Number of allocated names.
+    size_t num; // Number of initialized names.
+    size_t cur; // Innermost binder in scope.
+    struct binders *els;
+};
+
+//  Contexts.
+
+struct binds1 {
+        struct slices nam;
+        struct terms1 *trm;
+};
+
+struct contexts1 {
+    size_t cap;
+    size_t num;
+    struct binds1 *els;
+};
+
+struct binds2 {
+        struct slices nam;
+        struct terms2 *trm;
+        struct terms2 *ref; // The `DEF2` node referring here, or `NULL`.
+        struct slices bod;  // The source of `trm` while not yet parsed.
+};
+
+//  With `CTX2_DEFS` set, references to bindings are parsed to the
+//  `ref` of the binding (a `DEF2` node, closed like the bound term)
+//  instead of the term itself. Such nodes must not outlive `ctx`.
+//
+//  Bindings made by `index_declterms2` have `trm == NULL` until first
+//  referred to, and are then parsed from `bod` with `vis` lowered to
+//  their index: as when parsed in order, only the bindings before them
+//  are in scope.
+//
+//  Names are looked up in an open addressing table from their hash to
+//  their index plus one. It is brought up to date by lookups, so it may
+//  lag behind `num`, or hold entries of bindings since popped (as the
+//  server does); those are told apart by comparing names.
+
+struct contexts2 {
+    size_t cap;
+    size_t num;
+    size_t vis;         // Bindings of index `>= vis` are out of scope.
+    unsigned int flags;
+    struct binds2 *els;
+    size_t hcap;        // A power of two, or zero.
+    size_t hnum;        // Entries of `index`, stale or not.
+    size_t nindexed;    // Bindings entered in `index`.
+    unsigned int *index;
+};
+
+/* ***** ***** */
+
+//  Allocation of terms, identifiers and the parser's own structures, by
+//  the allocators in use by the thread (see `use_allocators`), if any,
+//  and otherwise by the C library. Whatever is freed must have been
+//  allocated by the same allocators.
+
+extern _Thread_local const struct allocators *cur_allocators;
+
+static inline void *alloc_bytes(size_t size)
+{
+    const struct allocators *a = cur_allocators;
+    return a ? a->alloc(a->env, size) : malloc(size);
+}
+
+static inline void *calloc_bytes(size_t n, size_t size)
+{
+    const struct allocators *a = cur_allocators;
+    if (!a) {return calloc(n, size);}
+    if (size && n > SIZE_MAX / size) {return NULL;}
+    void *p = a->alloc(a->env, n * size);
+    if (p) {memset(p, 0, n * size);}
+    return p;
+}
+
+static inline void *realloc_bytes(void *ptr, size_t size)
+{
+    const struct allocators *a = cur_allocators;
+    if (!a) {return realloc(ptr, size);}
+    return ptr ? a->realloc(a->env, ptr, size) : a->alloc(a->env, size);
+}
+
+static inline void free_bytes(void *ptr)
+{
+    const struct allocators *a = cur_allocators;
+    if (!a) {free(ptr); return;}
+    if (ptr) {a->free(a->env, ptr);}
+}
+
+/* ***** ***** */
+
+//  Identifiers.
+
+static inline int eq_slices(struct slices a, struct slices b)
+{
+    return a.len == b.len && !memcmp(a.str, b.str, a.len);
+}
+
+//  A heap copy of `x`, NUL-terminated for convenience.
+static inline struct slices copy_slices(struct slices x)
+{
+    char *str = alloc_bytes(x.len + 1);
+    if (!str) {
+        fprintf(stderr, "Malloc failed at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        return (struct slices) {.str = "", .len = 0, .own = 0};
+    }
+    memcpy(str, x.str, x.len);
+    str[x.len] = '\0';
+    return (struct slices) {.str = str, .len = x.len, .own = 1};
+}
+
+//  Another reference to the identifier `x`: borrowed slices point into
+//  a source and can simply be shared, owned ones must be copied.
+static inline struct slices dup_slices(struct slices x)
+{
+    return x.own ? copy_slices(x) : x;
+}
+
+static inline void free_slices(struct slices x)
+{
+    if (x.own) {free_bytes((char*) x.str);}
+}
+
+/* ***** ***** */
+
+//  Constructors of canonical terms. They take ownership of the
+//  references (and identifiers) passed to them.
+
+static inline struct terms1 *mk_var1(struct slices x)
+{
+    struct terms1 *var1 = alloc_bytes(sizeof(struct terms1));
+    MALCHECK(var1);
+    *var1 = (struct terms1) {.refcnt = 1, .tag = VAR1, .var = x};
+    return var1;
+}
+
+static inline struct terms1 *mk_num1(unsigned long n)
+{
+    struct terms1 *num1 = alloc_bytes(sizeof(struct terms1));
+    MALCHECK(num1);
+    *num1 = (struct terms1) {.refcnt = 1, .tag = NUM1, .num = n};
+    return num1;
+}
+
+static inline struct terms1 *mk_lam1(struct slices x, struct terms1 *bod)
+{
+    struct terms1 *lam1 = alloc_bytes(sizeof(struct terms1));
+    MALCHECK(lam1);
+    struct lams1 *lam1_lam = alloc_bytes(sizeof(struct lams1));
+    if (!lam1_lam) {free_bytes(lam1);}
+    MALCHECK(lam1_lam);
+    lam1_lam->var = x;
+    lam1_lam->bod = bod;
+    *lam1 = (struct terms1) {.refcnt = 1, .tag = LAM1, .lam = lam1_lam};
+    return lam1;
+}
+
+static inline struct terms1 *mk_app1(struct terms1 *fun, struct terms1 *arg)
+{
+    struct terms1 *app1 = alloc_bytes(sizeof(struct terms1));
+    MALCHECK(app1);
+    struct apps1 *app1_app = alloc_bytes(sizeof(struct apps1));
+    if (!app1_app) {free_bytes(app1);}
+    MALCHECK(app1_app);
+    app1_app->fun = fun;
+    app1_app->arg = arg;
+    *app1 = (struct terms1) {.refcnt = 1, .tag = APP1, .app = app1_app};
+    return app1;
+}
+
+//  Constructors of de Bruijn terms. They take ownership of the
+//  references passed to them, and allocate in the heap in use by the
+//  thread, if any.
+
+extern _Thread_local struct heaps *cur_heaps;
+extern _Thread_local struct profiles *cur_profiles;
+
+static inline unsigned int ccs_terms2(void)
+{
+    return cur_profiles ? alloc_ccs_profiles(cur_profiles) : 0;
+}
+
+#define IMM2_MAX ((unsigned long) (UINTPTR_MAX >> 2))
+
+static inline uint64_t mix_hash2(uint64_t h, uint64_t x)
+{
+    h ^= x + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h * 0xff51afd7ed558ccdULL;
+}
+
+//  The summaries of `t`, immediate or not (see `struct terms2`).
+
+static inline unsigned int fv_terms2(struct terms2 *t)
+{
+    if (!t) {return 0;}
+    if ((uintptr_t) t & 1) {
+        return ((uintptr_t) t & 3) == 1 ? ((uintptr_t) t >> 2) + 1 : 0;
+    }
+    return t->fv;
+}
+
+static inline uint32_t summary_hash2(struct terms2 *t)
+{
+    if (!t) {return 0;}
+    if ((uintptr_t) t & 1) {
+        uint64_t tag = ((uintptr_t) t & 3) == 1 ? VAR2 : NUM2;
+        return mix_hash2(tag, (uintptr_t) t >> 2) >> 32;
+    }
+    return t->hash;
+}
+
+//  Sets the summaries of the node `t` from those of its children.
+static inline void summarize_terms2(struct terms2 *t)
+{
+    unsigned int f, g;
+    switch (t->tag) {
+    case LAM2:
+        f = fv_terms2(t->lam);
+        t->fv = f ? f - 1 : 0;
+        t->hash = mix_hash2(LAM2, summary_hash2(t->lam)) >> 32;
+        break;
+    case APP2:
+        f = fv_terms2(t->app->fun);
+        g = fv_terms2(t->app->arg);
+        t->fv = f > g ? f : g;
+        t->hash = mix_hash2( mix_hash2(APP2, summary_hash2(t->app->fun))
+                           , summary_hash2(t->app->arg)) >> 32;
+        break;
+    case DEF2:
+        t->fv = 0;
+        t->hash = mix_hash2(DEF2, t->def->idx) >> 32;
+        break;
+    default:
+        t->fv = 0;
+        t->hash = mix_hash2(NUM2, t->num) >> 32;
+        break;
+    }
+}
+
+static inline struct terms2 *mk_var2(unsigned int idx)
+{
+    return (struct terms2*) ((uintptr_t) idx << 2 | 1);
+}
+
+static inline struct terms2 *mk_num2(unsigned long n)
+{
+    if (n <= IMM2_MAX) {return (struct terms2*) ((uintptr_t) n << 2 | 3);}
+    if (cur_heaps) {
+        struct terms2 *num2 = bump_heaps(cur_heaps, sizeof(struct terms2));
+        MALCHECK(num2);
+        *num2 = (struct terms2) { .refcnt = 0, .tag = NUM2
+                                 , .ccs = ccs_terms2(), .num = n };
+        summarize_terms2(num2);
+        return num2;
+    }
+    struct terms2 *num2 = alloc_bytes(sizeof(struct terms2));
+    MALCHECK(num2);
+    *num2 = (struct terms2) { .refcnt = 1, .tag = NUM2
+                             , .ccs = ccs_terms2(), .num = n };
+    summarize_terms2(num2);
+    return num2;
+}
+
+static inline struct terms2 *mk_def2(struct contexts2 *ctx, size_t idx)
+{
+    if (cur_heaps) {
+        struct terms2 *def2 = bump_heaps( cur_heaps, sizeof(struct terms2)
+                                                   + sizeof(struct defs2));
+        MALCHECK(def2);
+        def2->def = (struct defs2*) (def2 + 1);
+        *def2->def = (struct defs2) {.ctx = ctx, .idx = idx};
+        def2->refcnt = 0;
+        def2->tag = DEF2;
+        def2->ccs = ccs_terms2();
+        summarize_terms2(def2);
+        return def2;
+    }
+    struct terms2 *def2 = alloc_bytes(sizeof(struct terms2));
+    MALCHECK(def2);
+    struct defs2 *def2_def = alloc_bytes(sizeof(struct defs2));
+    if (!def2_def) {free_bytes(def2);}
+    MALCHECK(def2_def);
+    *def2_def = (struct defs2) {.ctx = ctx, .idx = idx};
+    *def2 = (struct terms2) { .refcnt = 1, .tag = DEF2
+                             , .ccs = ccs_terms2(), .def = def2_def };
+    summarize_terms2(def2);
+    return def2;
+}
+
+static inline struct terms2 *mk_lam2(struct terms2 *bod)
+{
+    if (cur_heaps) {
+        struct terms2 *lam2 = bump_heaps(cur_heaps, sizeof(struct terms2));
+        MALCHECK(lam2);
+        *lam2 = (struct terms2) { .refcnt = 0, .tag = LAM2
+                                 , .ccs = ccs_terms2(), .lam = bod };
+        summarize_terms2(lam2);
+        return lam2;
+    }
+    struct terms2 *lam2 = alloc_bytes(sizeof(struct terms2));
+    MALCHECK(lam2);
+    *lam2 = (struct terms2) { .refcnt = 1, .tag = LAM2
+                             , .ccs = ccs_terms2(), .lam = bod };
+    summarize_terms2(lam2);
+    return lam2;
+}
+
+static inline struct terms2 *mk_app2(struct terms2 *fun, struct terms2 *arg)
+{
+    if (cur_heaps) {
+        struct terms2 *app2 = bump_heaps( cur_heaps, sizeof(struct terms2)
+                                                   + sizeof(struct apps2));
+        MALCHECK(app2);
+        app2->app = (struct apps2*) (app2 + 1);
+        *app2->app = (struct apps2) {.fun = fun, .arg = arg};
+        app2->refcnt = 0;
+        app2->tag = APP2;
+        app2->ccs = ccs_terms2();
+        summarize_terms2(app2);
+        return app2;
+    }
+    struct terms2 *app2 = alloc_bytes(sizeof(struct terms2));
+    MALCHECK(app2);
+    struct apps2 *app2_app = alloc_bytes(sizeof(struct apps2));
+    if (!app2_app) {free_bytes(app2);}
+    MALCHECK(app2_app);
+    app2_app->fun = fun;
+    app2_app->arg = arg;
+    *app2 = (struct terms2) { .refcnt = 1, .tag = APP2
+                             , .ccs = ccs_terms2(), .app = app2_app };
+    summarize_terms2(app2);
+    return app2;
+}
+
+//  Accessors of de Bruijn terms, immediate or not.
+
+static inline int imm_terms2(struct terms2 *t)
+{
+    return (uintptr_t) t & 1;
+}
+
+static inline int tag_terms2(struct terms2 *t)
+{
+    switch ((uintptr_t) t & 3) {
+    case 1:  return VAR2;
+    case 3:  return NUM2;
+    default: return t->tag;
+    }
+}
+
+//  Whether `t` is reference counted, i.e., neither immediate nor in a
+//  heap.
+static inline int counted_terms2(struct terms2 *t)
+{
+    return !imm_terms2(t) && t->refcnt;
+}
+
+//  Whether the caller's reference to `t` is the only one, so that `t`
+//  may be updated in place instead of freed and rebuilt.
+static inline int unique_terms2(struct terms2 *t)
+{
+    return !imm_terms2(t) && t->refcnt == 1;
+}
+
+static inline unsigned int idx_terms2(struct terms2 *t)
+{
+    return (uintptr_t) t >> 2;
+}
+
+static inline unsigned long num_terms2(struct terms2 *t)
+{
+    return imm_terms2(t) ? (uintptr_t) t >> 2 : t->num;
+}
+
+//  The term a `DEF2` node stands for (borrowed), and its name.
+
+static inline struct terms2 *unfold_def2(struct terms2 *t)
+{
+    return t->def->ctx->els[t->def->idx].trm;
+}
+
+static inline struct slices name_def2(struct terms2 *t)
+{
+    return t->def->ctx->els[t->def->idx].nam;
+}
+
+/* ***** ***** */
+
+#endif // LAMBDA_TERMS_H
@@ -0,0 +1,340 @@
+/*
+    ╔═══════╗
+    ║ LEXER ║
+    ╚═══════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "lexer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+#define LEXER_X86 1
+#include <immintrin.h>
+#endif
+#endif
+
+/* ***** ***** */
+
+//  Scalar classification. Runs of white-space and identifiers in lambda
+//  source are mostly a char or two long, so every scan first tests one
+//  char this way before going wide.
+
+static inline int is_ws(unsigned char c)
+{
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+static inline int is_id(unsigned char c)
+{
+    return (unsigned char) (c - '0') <= 9
+        || (unsigned char) ((c | 0x20) - 'a') <= 'z' - 'a'
+        || c == '_';
+}
+
+static inline int is_st(unsigned char c)
+{
+    return c == '\\' || c == '.' || c == '(' || c == ')'
+        || c == '@' || c == '=';
+}
+
+static size_t skip_whitespace_scalar(const char *buf, size_t pos
+                                                    , size_t len)
+{
+    while (pos < len && is_ws(buf[pos])) {pos++;}
+    return pos;
+}
+
+static size_t skip_identifier_scalar(const char *buf, size_t pos
+                                                    , size_t len)
+{
+    while (pos < len && is_id(buf[pos])) {pos++;}
+    return pos;
+}
+
+static size_t find_structural_scalar(const char *buf, size_t pos
+                                                    , size_t len)
+{
+    while (pos < len && !is_st(buf[pos])) {pos++;}
+    return pos;
+}
+
+//  Counts parentheses from `pos` on, starting at `depth > 0`.
+static size_t skip_balanced_scalar(const char *buf, size_t pos
+                                                  , size_t len
+                                                  , size_t depth)
+{
+    for (; pos < len; pos++) {
+        if (buf[pos] == '@') {
+            return pos;
+        } else if (buf[pos] == '(') {
+            depth++;
+        } else if (buf[pos] == ')' && !--depth) {
+            return pos;
+        }
+    }
+    return pos;
+}
+
+/* ***** ***** */
+
+#ifdef LEXER_X86
+
+//  Byte masks of the classes. `x - lo <= hi - lo` for unsigned bytes is
+//  tested as `min(x - lo, hi - lo) == x - lo`, there being no unsigned
+//  byte compare.
+
+static inline __m128i range128(__m128i v, char lo, char hi)
+{
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(hi - lo)), d);
+}
+
+static inline __m128i eq128(__m128i v, char c)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+static inline __m128i ws128(__m128i v)
+{
+    return _mm_or_si128(eq128(v, ' '), range128(v, '\t', '\r'));
+}
+
+static inline __m128i id128(__m128i v)
+{
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(_mm_or_si128( range128(v, '0', '9')
+                                    , range128(lower, 'a', 'z'))
+                       , eq128(v, '_'));
+}
+
+static inline __m128i st128(__m128i v)
+{
+    return _mm_or_si128(_mm_or_si128( _mm_or_si128( eq128(v, '\\')
+                                                  , eq128(v, '.'))
+                                    , range128(v, '(', ')'))
+                       , _mm_or_si128(eq128(v, '@'), eq128(v, '=')));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i range256(__m256i v, char lo, char hi)
+{
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(hi - lo)), d);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i eq256(__m256i v, char c)
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i ws256(__m256i v)
+{
+    return _mm256_or_si256(eq256(v, ' '), range256(v, '\t', '\r'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i id256(__m256i v)
+{
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(_mm256_or_si256( range256(v, '0', '9')
+                                          , range256(lower, 'a', 'z'))
+                          , eq256(v, '_'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i st256(__m256i v)
+{
+    return _mm256_or_si256(
+        _mm256_or_si256( _mm256_or_si256(eq256(v, '\\'), eq256(v, '.'))
+                       , range256(v, '(', ')'))
+      , _mm256_or_si256(eq256(v, '@'), eq256(v, '=')));
+}
+
+//  Advances `pos` a vector at a time while the class mask `CLASS` holds
+//  for all bytes (`WHILE == 1`) or for none (`WHILE == 0`), then finds
+//  the first byte where it stops doing so; the tail is left to `TAIL`.
+#define SCAN(BYTES, LOAD, MOVEMASK, CLASS, WHILE, TAIL)                 \
+    while (pos + BYTES <= len) {                                        \
+        uint32_t m = (uint32_t) MOVEMASK(CLASS(LOAD(buf + pos)));       \
+        if (WHILE) {m = ~m;}                                            \
+        if (BYTES < 32) {m &= (1u << (BYTES % 32)) - 1;}                \
+        if (m) {return pos + __builtin_ctz(m);}                         \
+        pos += BYTES;                                                   \
+    }                                                                   \
+    return TAIL(buf, pos, len);
+
+//  Counts parentheses a vector at a time: a vector without an '@' and
+//  with fewer ')' than the depth cannot end the scan, so it is added up
+//  by popcounts; otherwise its '(', ')' and '@' are visited in order.
+#define BALANCE(BYTES, LOAD, MOVEMASK, EQ)                              \
+    while (pos + BYTES <= len) {                                        \
+        __typeof__(LOAD(buf)) v = LOAD(buf + pos);                      \
+        uint32_t op = (uint32_t) MOVEMASK(EQ(v, '('));                  \
+        uint32_t cl = (uint32_t) MOVEMASK(EQ(v, ')'));                  \
+        uint32_t at = (uint32_t) MOVEMASK(EQ(v, '@'));                  \
+        if (!at && depth > (size_t) __builtin_popcount(cl)) {           \
+            depth += __builtin_popcount(op);                            \
+            depth -= __builtin_popcount(cl);                            \
+            pos += BYTES;                                               \
+            continue;                                                   \
+        }                                                               \
+        for (uint32_t m = op | cl | at; m; m &= m - 1) {                \
+            unsigned int i = __builtin_ctz(m);                          \
+            if (at >> i & 1) {return pos + i;}                          \
+            if (op >> i & 1) {                                          \
+                depth++;                                                \
+            } else if (!--depth) {                                      \
+                return pos + i;                                         \
+            }                                                           \
+        }                                                               \
+        pos += BYTES;                                                   \
+    }                                                                   \
+    return skip_balanced_scalar(buf, pos, len, depth);
+
+#define LOAD128(p) _mm_loadu_si128((const __m128i*) (p))
+#define LOAD256(p) _mm256_loadu_si256((const __m256i*) (p))
+
+static size_t skip_whitespace_sse2(const char *buf, size_t pos, size_t len)
+{
+    SCAN(16, LOAD128, _mm_movemask_epi8, ws128, 1, skip_whitespace_scalar)
+}
+
+static size_t skip_identifier_sse2(const char *buf, size_t pos, size_t len)
+{
+    SCAN(16, LOAD128, _mm_movemask_epi8, id128, 1, skip_identifier_scalar)
+}
+
+static size_t find_structural_sse2(const char *buf, size_t pos, size_t len)
+{
+    SCAN(16, LOAD128, _mm_movemask_epi8, st128, 0, find_structural_scalar)
+}
+
+static size_t skip_balanced_sse2( const char *buf, size_t pos, size_t len
+                                , size_t depth)
+{
+    BALANCE(16, LOAD128, _mm_movemask_epi8, eq128)
+}
+
+__attribute__((target("avx2")))
+static size_t skip_whitespace_avx2(const char *buf, size_t pos, size_t len)
+{
+    SCAN(32, LOAD256, _mm256_movemask_epi8, ws256, 1, skip_whitespace_scalar)
+}
+
+__attribute__((target("avx2")))
+static size_t skip_identifier_avx2(const char *buf, size_t pos, size_t len)
+{
+    SCAN(32, LOAD256, _mm256_movemask_epi8, id256, 1, skip_identifier_scalar)
+}
+
+__attribute__((target("avx2")))
+static size_t find_structural_avx2(const char *buf, size_t pos, size_t len)
+{
+    SCAN(32, LOAD256, _mm256_movemask_epi8, st256, 0, find_structural_scalar)
+}
+
+__attribute__((target("avx2")))
+static size_t skip_balanced_avx2( const char *buf, size_t pos, size_t len
+                                , size_t depth)
+{
+    BALANCE(32, LOAD256, _mm256_movemask_epi8, eq256)
+}
+
+#endif // LEXER_X86
+
+/* ***** ***** */
+
+//  Dispatch, resolved once, on first use, by whichever thread (e.g., of
+//  the server's workers) gets there first. Once `lexer_ready` is seen
+//  set, the pointers are too, so that later uses skip `pthread_once`.
+
+typedef size_t (*scans)(const char *buf, size_t pos, size_t len);
+typedef size_t (*balances)( const char *buf, size_t pos, size_t len
+                          , size_t depth);
+
+static scans skip_whitespace_impl;
+static scans skip_identifier_impl;
+static scans find_structural_impl;
+static balances skip_balanced_impl;
+static const char *isa;
+static pthread_once_t lexer_once = PTHREAD_ONCE_INIT;
+static atomic_int lexer_ready;
+
+static void init_lexer(void)
+{
+#ifdef LEXER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        skip_whitespace_impl = skip_whitespace_avx2;
+        skip_identifier_impl = skip_identifier_avx2;
+        find_structural_impl = find_structural_avx2;
+        skip_balanced_impl = skip_balanced_avx2;
+        isa = "avx2";
+        atomic_store_explicit(&lexer_ready, 1, memory_order_release);
+        return;
+    }
+    skip_whitespace_impl = skip_whitespace_sse2;
+    skip_identifier_impl = skip_identifier_sse2;
+    find_structural_impl = find_structural_sse2;
+    skip_balanced_impl = skip_balanced_sse2;
+    isa = "sse2";
+#else
+    skip_whitespace_impl = skip_whitespace_scalar;
+    skip_identifier_impl = skip_identifier_scalar;
+    find_structural_impl = find_structural_scalar;
+    skip_balanced_impl = skip_balanced_scalar;
+    isa = "scalar";
+#endif
+    atomic_store_explicit(&lexer_ready, 1, memory_order_release);
+}
+
+static inline void use_lexer(void)
+{
+    if (!atomic_load_explicit(&lexer_ready, memory_order_acquire)) {
+        pthread_once(&lexer_once, init_lexer);
+    }
+}
+
+size_t skip_whitespace(const char *buf, size_t pos, size_t len)
+{
+    if (pos >= len || !is_ws(buf[pos])) {return pos;}
+    use_lexer();
+    return skip_whitespace_impl(buf, pos + 1, len);
+}
+
+size_t skip_identifier(const char *buf, size_t pos, size_t len)
+{
+    if (pos >= len || !is_id(buf[pos])) {return pos;}
+    use_lexer();
+    return skip_identifier_impl(buf, pos + 1, len);
+}
+
+size_t find_structural(const char *buf, size_t pos, size_t len)
+{
+    if (pos >= len || is_st(buf[pos])) {return pos;}
+    use_lexer();
+    return find_structural_impl(buf, pos + 1, len);
+}
+
+size_t skip_balanced(const char *buf, size_t pos, size_t len)
+{
+    if (pos >= len || buf[pos] != '(') {return pos;}
+    use_lexer();
+    return skip_balanced_impl(buf, pos + 1, len, 1);
+}
+
+const char *lexer_isa(void)
+{
+    use_lexer();
+    return isa;
+}
@@ -0,0 +1,62 @@
+/**
+ *          ╔═══════╗
+ *          ║ LEXER ║
+ *          ╚═══════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Character class scanning for the parsers, classifying 16
+ *          (SSE2) or 32 (AVX2) bytes at a time. The instruction set is
+ *          picked at runtime on x86; elsewhere, scalar code is used.
+ *          All functions take a buffer `buf` of `len` chars and a start
+ *          position `pos <= len`, never read at or past `buf[len]`, and
+ *          return a position in `[pos, len]`.
+ */
+
+/* ***** ***** */
+
+#ifndef LEXER_H
+#define LEXER_H
+
+/* ***** ***** */
+
+#include <stddef.h>
+
+/* ***** ***** */
+
+/**
+ * \brief   Position of the first char at or after `pos` that is not
+ *          white-space (in the sense of `isspace` in the "C" locale).
+ */
+size_t skip_whitespace(const char *buf, size_t pos, size_t len);
+
+/**
+ * \brief   Position of the first char at or after `pos` that cannot be
+ *          part of an identifier, i.e., is neither alpha-numeric nor
+ *          '_'.
+ */
+size_t skip_identifier(const char *buf, size_t pos, size_t len);
+
+/**
+ * \brief   Position of the first structural char, one of
+ *          '\\', '.', '(', ')', '@' and '=', at or after `pos`; `len`
+ *          if there is none.
+ */
+size_t find_structural(const char *buf, size_t pos, size_t len);
+
+/**
+ * \brief   If `buf[pos]` is '(', the position of the matching ')',
+ *          found by counting parentheses only, or of the first '@'
+ *          before it, or `len` if there is neither; otherwise `pos`.
+ */
+size_t skip_balanced(const char *buf, size_t pos, size_t len);
+
+/**
+ * \brief   Name of the instruction set in use: "avx2", "sse2" or
+ *          "scalar".
+ */
+const char *lexer_isa(void);
+
+/* ***** ***** */
+
+#endif // LEXER_H
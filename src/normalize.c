@@ -0,0 +1,925 @@
+/*
+    ╔═══════════════╗
+    ║ NORMALIZATION ║
+    ╚═══════════════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lambda_terms.h"
+#include "normalize.h"
+
+/* ***** ***** */
+
+//  Structural identity.
+
+//  Both are kept in the nodes (see `struct terms2`), so that looking up
+//  a shared term in the cache does not walk it as a tree.
+
+uint64_t hash_terms2(struct terms2 *t)
+{
+    return summary_hash2(t);
+}
+
+int equal_terms2(struct terms2 *a, struct terms2 *b)
+{
+    while (a != b) {
+        if (summary_hash2(a) != summary_hash2(b)) {return 0;}
+        if (tag_terms2(a) != tag_terms2(b)) {return 0;}
+        switch (tag_terms2(a)) {
+        case VAR2:
+            return idx_terms2(a) == idx_terms2(b);
+        case NUM2:
+            return num_terms2(a) == num_terms2(b);
+        case DEF2:
+            return a->def->ctx == b->def->ctx && a->def->idx == b->def->idx;
+        case LAM2:
+            a = a->lam; b = b->lam;
+            break;
+        case APP2:
+            if (!equal_terms2(a->app->fun, b->app->fun)) {return 0;}
+            a = a->app->arg; b = b->app->arg;
+            break;
+        }
+    }
+    return 1;
+}
+
+unsigned int free_terms2(struct terms2 *t)
+{
+    return fv_terms2(t);
+}
+
+/* ***** ***** */
+
+//  Numerals. A `NUM2` is closed, so shifting and substitution leave it
+//  alone. It is never expanded into a Church numeral as a whole: when
+//  applied, `(#n f)` is unfolded one step, to `\(f ((#n-1 f) 0))`, and
+//  only if `f` is a value, since `f^n` of a neutral `f` cannot reduce.
+//  Arithmetic on numerals thereby stays O(digits) in time and space,
+//  the normal form folding such iterates back up (see `fold_num2`).
+
+static int mul_num2(unsigned long a, unsigned long b, unsigned long *res)
+{
+    return !__builtin_mul_overflow(a, b, res);
+}
+
+//  `m^n`, the normal form of `(#n #m)`, if it fits.
+static int pow_num2(unsigned long m, unsigned long n, unsigned long *res)
+{
+    unsigned long r = 1;
+    if (m <= 1) {*res = n ? m : 1; return 1;}
+    for (; n; n--) {
+        if (!mul_num2(r, m, &r)) {return 0;}
+    }
+    *res = r;
+    return 1;
+}
+
+//  Weak head normal form of `(#n a)`, consuming the reference to `num`.
+//  `a` is forced only if `n > 0`, to tell `m^n`, a neutral iterate and
+//  a one-step unfolding apart: `(#0 a)` drops it, even if divergent.
+static struct terms2 *whnf_num2(struct terms2 *num, struct terms2 *a)
+{
+    unsigned long n = num_terms2(num), p;
+    if (n == 0) {decref_terms2(num); return mk_lam2(mk_var2(0));}
+    struct terms2 *f = whnf_terms2(a);
+    if (tag_terms2(f) == NUM2 && pow_num2(num_terms2(f), n, &p)) {
+        decref_terms2(num); decref_terms2(f);
+        return mk_num2(p);
+    }
+    if (tag_terms2(f) != LAM2 && tag_terms2(f) != NUM2) {
+        // Neutral: `(#n f)` is as reduced as `f` is.
+        return mk_app2(num, f);
+    }
+    struct terms2 *g = shift_terms2(f, 1, 0);
+    struct terms2 *rest = mk_var2(0);
+    decref_terms2(f);
+    if (n > 1) {
+        incref_terms2(g);
+        rest = mk_app2(mk_app2(mk_num2(n - 1), g), rest);
+    }
+    decref_terms2(num);
+    return mk_lam2(mk_app2(g, rest));
+}
+
+struct terms2 *compact_terms2(struct terms2 *t)
+{
+    if (tag_terms2(t) == LAM2 && tag_terms2(t->lam) == LAM2) {
+        unsigned long n = 0;
+        struct terms2 *bod = t->lam->lam;
+        while (tag_terms2(bod) == APP2 && tag_terms2(bod->app->fun) == VAR2
+                                && idx_terms2(bod->app->fun) == 1) {
+            bod = bod->app->arg;
+            n++;
+        }
+        if (tag_terms2(bod) == VAR2 && idx_terms2(bod) == 0) {return mk_num2(n);}
+    }
+    incref_terms2(t);
+    return t;
+}
+
+/* ***** ***** */
+
+//  Reduction. Subterms that come out unchanged are shared rather than
+//  rebuilt, which keeps (closed) context terms identical by pointer.
+//  Those without free indexes that a shift or substitution would touch
+//  (e.g., closed ones) are not even walked, so that shared terms cost
+//  as many steps as they have nodes, not as they have as trees.
+
+struct terms2 *shift_terms2(struct terms2 *t, int d, unsigned int cut)
+{
+    struct terms2 *bod, *fun, *arg;
+    if (d == 0 || fv_terms2(t) <= cut) {incref_terms2(t); return t;}
+    switch (tag_terms2(t)) {
+    case VAR2:
+        return mk_var2(idx_terms2(t) + d);
+    case LAM2:
+        bod = shift_terms2(t->lam, d, cut + 1);
+        if (bod == t->lam) {decref_terms2(bod); break;}
+        return mk_lam2(bod);
+    case NUM2:
+    case DEF2:
+        break;
+    case APP2:
+        fun = shift_terms2(t->app->fun, d, cut);
+        arg = shift_terms2(t->app->arg, d, cut);
+        if (fun == t->app->fun && arg == t->app->arg) {
+            decref_terms2(fun); decref_terms2(arg);
+            break;
+        }
+        return mk_app2(fun, arg);
+    }
+    incref_terms2(t);
+    return t;
+}
+
+static struct terms2 *subst_aux(struct terms2 *t, struct terms2 *arg
+                                                , unsigned int k)
+{
+    struct terms2 *bod, *fun, *arg1;
+    if (fv_terms2(t) <= k) {incref_terms2(t); return t;}
+    switch (tag_terms2(t)) {
+    case VAR2:
+        if (idx_terms2(t) == k) {return shift_terms2(arg, k, 0);}
+        if (idx_terms2(t) > k) {return mk_var2(idx_terms2(t) - 1);}
+        break;
+    case LAM2:
+        bod = subst_aux(t->lam, arg, k + 1);
+        if (bod == t->lam) {decref_terms2(bod); break;}
+        return mk_lam2(bod);
+    case NUM2:
+    case DEF2:
+        break;
+    case APP2:
+        fun = subst_aux(t->app->fun, arg, k);
+        arg1 = subst_aux(t->app->arg, arg, k);
+        if (fun == t->app->fun && arg1 == t->app->arg) {
+            decref_terms2(fun); decref_terms2(arg1);
+            break;
+        }
+        return mk_app2(fun, arg1);
+    }
+    incref_terms2(t);
+    return t;
+}
+
+struct terms2 *subst_terms2(struct terms2 *bod, struct terms2 *arg)
+{
+    return subst_aux(bod, arg, 0);
+}
+
+//  Reuse. A rewrite consuming a unique node (see `unique_terms2`) that
+//  builds one of the same shape updates it in place: its references to
+//  the children are handed to the recursive calls rather than copied
+//  and dropped, and the node is neither freed nor allocated. Shared
+//  nodes are rewritten as above.
+
+//  As `subst_aux`, but consuming the reference to `t`.
+static struct terms2 *subst_own(struct terms2 *t, struct terms2 *arg
+                                                , unsigned int k)
+{
+    struct terms2 *res;
+    if (fv_terms2(t) <= k) {return t;}
+    if (!unique_terms2(t)) {
+        res = subst_aux(t, arg, k);
+        decref_terms2(t);
+        return res;
+    }
+    // Counts as built anew, when profiling.
+    if (cur_profiles) {t->ccs = ccs_terms2();}
+    switch (t->tag) {
+    case LAM2:
+        t->lam = subst_own(t->lam, arg, k + 1);
+        break;
+    case APP2:
+        t->app->fun = subst_own(t->app->fun, arg, k);
+        t->app->arg = subst_own(t->app->arg, arg, k);
+        break;
+    default:
+        break;
+    }
+    summarize_terms2(t);
+    return t;
+}
+
+//  The body of the lambda `t`, consuming `t`. A unique `t` hands over
+//  its reference and is freed on its own.
+static struct terms2 *take_lam2(struct terms2 *t)
+{
+    struct terms2 *bod = t->lam;
+    if (unique_terms2(t)) {free_bytes(t); return bod;}
+    incref_terms2(bod);
+    decref_terms2(t);
+    return bod;
+}
+
+//  Likewise the function and argument of the application `t`.
+static void take_app2( struct terms2 *t, struct terms2 **fun
+                                       , struct terms2 **arg)
+{
+    *fun = t->app->fun;
+    *arg = t->app->arg;
+    if (unique_terms2(t)) {free_bytes(t->app); free_bytes(t); return;}
+    incref_terms2(*fun); incref_terms2(*arg);
+    decref_terms2(t);
+}
+
+struct terms2 *whnf_terms2(struct terms2 *t)
+{
+    incref_terms2(t);
+    while (tag_terms2(t) == APP2 || tag_terms2(t) == DEF2) {
+        // References to declarations are unfolded once they are needed,
+        // i.e., at the head.
+        if (tag_terms2(t) == DEF2) {
+            struct terms2 *def = unfold_def2(t);
+            incref_terms2(def);
+            decref_terms2(t);
+            t = def;
+            continue;
+        }
+        struct terms2 *fun = whnf_terms2(t->app->fun);
+        struct profiles *prof = cur_profiles;
+        unsigned int ccs;
+        if (tag_terms2(fun) == NUM2) {
+            ccs = prof ? step_ccs_profiles(prof, t->ccs, 0) : 0;
+            struct terms2 *res = whnf_num2(fun, t->app->arg);
+            if (prof) {set_ccs_profiles(prof, ccs);}
+            decref_terms2(t);
+            if (tag_terms2(res) == APP2) {return res;}
+            t = res;
+            continue;
+        }
+        if (tag_terms2(fun) != LAM2) {
+            if (fun == t->app->fun) {decref_terms2(fun); return t;}
+            if (unique_terms2(t)) {
+                decref_terms2(t->app->fun);
+                t->app->fun = fun;
+                summarize_terms2(t);
+                return t;
+            }
+            struct terms2 *arg = t->app->arg;
+            incref_terms2(arg);
+            decref_terms2(t);
+            return mk_app2(fun, arg);
+        }
+        // The redex is consumed, so that the body is rewritten in place
+        // when nothing else refers to it (e.g., the contractum of the
+        // previous step, in `((\\b x) y)`).
+        struct terms2 *fun0, *arg;
+        ccs = prof ? step_ccs_profiles(prof, t->ccs, fun->ccs) : 0;
+        take_app2(t, &fun0, &arg);
+        decref_terms2(fun0);
+        t = subst_own(take_lam2(fun), arg, 0);
+        decref_terms2(arg);
+        if (prof) {set_ccs_profiles(prof, ccs);}
+    }
+    return t;
+}
+
+/* ***** ***** */
+
+//  Normal form cache: a chained hash table whose entries are also
+//  threaded on a doubly linked list in order of last use.
+
+struct nfentries {
+    uint64_t hash;
+    size_t bytes;
+    struct terms2 *key;
+    struct terms2 *nf;
+    struct nfentries *next; // Next in bucket.
+    struct nfentries *newer;
+    struct nfentries *older;
+};
+
+struct nfcaches {
+    size_t cap;     // Bound on `bytes`.
+    size_t bytes;   // Estimated bytes held by the entries.
+    size_t num;
+    size_t nbuckets;
+    struct nfentries **buckets;
+    struct nfentries *newest;
+    struct nfentries *oldest;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+struct nfcaches *alloc_nfcaches(size_t cap)
+{
+    struct nfcaches *nfc = malloc(sizeof(struct nfcaches));
+    MALCHECK(nfc);
+    struct nfentries **tmp = calloc(64, sizeof(struct nfentries*));
+    if (!tmp) {free(nfc);}
+    MALCHECK(tmp);
+    *nfc = (struct nfcaches) {.cap = cap, .nbuckets = 64, .buckets = tmp};
+    return nfc;
+}
+
+static void free_nfentries(struct nfentries *e)
+{
+    decref_terms2(e->key);
+    decref_terms2(e->nf);
+    free(e);
+}
+
+void free_nfcaches(struct nfcaches *nfc)
+{
+    if (!nfc) {return;}
+    struct nfentries *e = nfc->newest;
+    while (e) {
+        struct nfentries *older = e->older;
+        free_nfentries(e);
+        e = older;
+    }
+    free(nfc->buckets); free(nfc);
+}
+
+struct nfstats stats_nfcaches(struct nfcaches *nfc)
+{
+    return (struct nfstats) { .hits = nfc->hits
+                            , .misses = nfc->misses
+                            , .evictions = nfc->evictions
+                            , .entries = nfc->num
+                            , .bytes = nfc->bytes };
+}
+
+void scan_nfcaches(void *obj, visitors v, void *env)
+{
+    struct nfcaches *nfc = obj;
+    for (struct nfentries *e = nfc->newest; e; e = e->older) {
+        v(&e->key, env);
+        v(&e->nf, env);
+    }
+}
+
+//  Estimated heap footprint of a term. Shared nodes (other than `t`)
+//  are counted as one node each, without what they point to: that is
+//  kept alive by the others too, and counting it per occurrence would
+//  take exponential time for terms built by sharing. Immediate leaves
+//  take none.
+static size_t bytes_unique2(struct terms2 *t);
+
+static size_t bytes_terms2(struct terms2 *t)
+{
+    if (imm_terms2(t)) {return 0;}
+    switch (tag_terms2(t)) {
+    case VAR2:
+    case NUM2:
+        return sizeof(struct terms2);
+    case DEF2:
+        return sizeof(struct terms2) + sizeof(struct defs2);
+    case LAM2:
+        return sizeof(struct terms2) + bytes_unique2(t->lam);
+    case APP2:
+        return sizeof(struct terms2) + sizeof(struct apps2)
+             + bytes_unique2(t->app->fun) + bytes_unique2(t->app->arg);
+    }
+    return 0;
+}
+
+static size_t bytes_unique2(struct terms2 *t)
+{
+    if (imm_terms2(t)) {return 0;}
+    if (t->refcnt != 1) {
+        return sizeof(struct terms2)
+             + (t->tag == APP2 ? sizeof(struct apps2) : 0);
+    }
+    return bytes_terms2(t);
+}
+
+static void unlink_nfentries(struct nfcaches *nfc, struct nfentries *e)
+{
+    if (e->newer) {e->newer->older = e->older;} else {nfc->newest = e->older;}
+    if (e->older) {e->older->newer = e->newer;} else {nfc->oldest = e->newer;}
+}
+
+static void link_nfentries(struct nfcaches *nfc, struct nfentries *e)
+{
+    e->newer = NULL;
+    e->older = nfc->newest;
+    if (nfc->newest) {nfc->newest->newer = e;} else {nfc->oldest = e;}
+    nfc->newest = e;
+}
+
+static struct nfentries *lookup_nfcaches(struct nfcaches *nfc
+                                        , struct terms2 *t, uint64_t h)
+{
+    struct nfentries *e = nfc->buckets[h & (nfc->nbuckets - 1)];
+    for (; e; e = e->next) {
+        if (e->hash == h && equal_terms2(e->key, t)) {
+            unlink_nfentries(nfc, e);
+            link_nfentries(nfc, e);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void evict_nfcaches(struct nfcaches *nfc)
+{
+    struct nfentries *e = nfc->oldest;
+    struct nfentries **p = &nfc->buckets[e->hash & (nfc->nbuckets - 1)];
+    while (*p != e) {p = &(*p)->next;}
+    *p = e->next;
+    unlink_nfentries(nfc, e);
+    nfc->bytes -= e->bytes;
+    nfc->num--;
+    nfc->evictions++;
+    free_nfentries(e);
+}
+
+static void grow_nfcaches(struct nfcaches *nfc)
+{
+    size_t nbuckets = nfc->nbuckets * 2;
+    struct nfentries **tmp = calloc(nbuckets, sizeof(struct nfentries*));
+    if (!tmp) {return;} // Just keep the longer chains.
+    for (size_t i = 0; i < nfc->nbuckets; i++) {
+        struct nfentries *e = nfc->buckets[i];
+        while (e) {
+            struct nfentries *next = e->next;
+            e->next = tmp[e->hash & (nbuckets - 1)];
+            tmp[e->hash & (nbuckets - 1)] = e;
+            e = next;
+        }
+    }
+    free(nfc->buckets);
+    nfc->buckets = tmp;
+    nfc->nbuckets = nbuckets;
+}
+
+static void insert_nfcaches(struct nfcaches *nfc, struct terms2 *t
+                                                , uint64_t h
+                                                , struct terms2 *nf)
+{
+    size_t bytes = sizeof(struct nfentries)
+                 + bytes_terms2(t) + bytes_terms2(nf);
+    if (bytes > nfc->cap) {return;}
+    while (nfc->bytes + bytes > nfc->cap) {evict_nfcaches(nfc);}
+    struct nfentries *e = malloc(sizeof(struct nfentries));
+    if (!e) {return;}
+    incref_terms2(t); incref_terms2(nf);
+    *e = (struct nfentries) { .hash = h, .bytes = bytes
+                            , .key = t, .nf = nf };
+    if (nfc->num >= nfc->nbuckets) {grow_nfcaches(nfc);}
+    e->next = nfc->buckets[h & (nfc->nbuckets - 1)];
+    nfc->buckets[h & (nfc->nbuckets - 1)] = e;
+    link_nfentries(nfc, e);
+    nfc->bytes += bytes;
+    nfc->num++;
+}
+
+/* ***** ***** */
+
+//  Normalization.
+
+static struct terms2 *nf_terms2(struct terms2 *t, struct nfcaches *nfc);
+
+//  Whether the variable of index `k` occurs (free) in `t`.
+static int occurs_terms2(struct terms2 *t, unsigned int k)
+{
+    if (fv_terms2(t) <= k) {return 0;}
+    switch (tag_terms2(t)) {
+    case VAR2:
+        return idx_terms2(t) == k;
+    case LAM2:
+        return occurs_terms2(t->lam, k + 1);
+    case APP2:
+        return occurs_terms2(t->app->fun, k)
+            || occurs_terms2(t->app->arg, k);
+    default:
+        return 0;
+    }
+}
+
+static int is_iter2(struct terms2 *t)
+{
+    return tag_terms2(t) == APP2 && tag_terms2(t->app->fun) == APP2
+                          && tag_terms2(t->app->fun->app->fun) == NUM2;
+}
+
+//  Folds the normal form `(fun arg)` when it iterates a neutral `f`:
+//  `(#a (#b f))` to `(#ab f)`, `((#a f) ((#b f) x))` to `((#a+b f) x)`
+//  and `(f ((#b f) x))` to `((#b+1 f) x)`. These are how `mult`, `plus`
+//  and `succ` come out. Returns `NULL` if there is nothing to fold.
+static struct terms2 *fold_num2(struct terms2 *fun, struct terms2 *arg)
+{
+    unsigned long a, b, n;
+    struct terms2 *f, *x;
+    if (tag_terms2(fun) == NUM2 && tag_terms2(arg) == APP2
+                         && tag_terms2(arg->app->fun) == NUM2) {
+        if (!mul_num2(num_terms2(fun), num_terms2(arg->app->fun), &n)) {return NULL;}
+        f = arg->app->arg;
+        incref_terms2(f);
+        return mk_app2(mk_num2(n), f);
+    }
+    if (!is_iter2(arg)) {return NULL;}
+    b = num_terms2(arg->app->fun->app->fun);
+    f = arg->app->fun->app->arg;
+    x = arg->app->arg;
+    if (tag_terms2(fun) == APP2 && tag_terms2(fun->app->fun) == NUM2
+                         && equal_terms2(fun->app->arg, f)) {
+        a = num_terms2(fun->app->fun);
+    } else if (equal_terms2(fun, f)) {
+        a = 1;
+    } else {
+        return NULL;
+    }
+    if (__builtin_add_overflow(a, b, &n)) {return NULL;}
+    incref_terms2(f); incref_terms2(x);
+    return mk_app2(mk_app2(mk_num2(n), f), x);
+}
+
+//  Eta-contracts `\(#n 0)` to `#n` and `\((#n g) 0)` to `(#n g)`, so
+//  that folded iterates become numerals again. Returns `NULL` if `bod`
+//  is of neither form.
+static struct terms2 *eta_num2(struct terms2 *bod)
+{
+    if (tag_terms2(bod) != APP2 || tag_terms2(bod->app->arg) != VAR2
+                         || idx_terms2(bod->app->arg) != 0) {
+        return NULL;
+    }
+    struct terms2 *fun = bod->app->fun;
+    if (tag_terms2(fun) == NUM2) {return mk_num2(num_terms2(fun));}
+    if (tag_terms2(fun) != APP2 || tag_terms2(fun->app->fun) != NUM2
+                         || occurs_terms2(fun->app->arg, 0)) {
+        return NULL;
+    }
+    return mk_app2( mk_num2(num_terms2(fun->app->fun))
+                  , shift_terms2(fun->app->arg, -1, 0));
+}
+
+//  Normal form of a term already in weak head normal form, consuming
+//  the reference to `w`.
+static struct terms2 *nf_whnf(struct terms2 *w, struct nfcaches *nfc)
+{
+    struct terms2 *res, *bod, *fun, *arg;
+    switch (tag_terms2(w)) {
+    case VAR2:
+        return w;
+    case LAM2:
+        bod = nf_terms2(w->lam, nfc);
+        res = eta_num2(bod);
+        if (res) {decref_terms2(bod); break;}
+        if (bod == w->lam) {decref_terms2(bod); return w;}
+        if (unique_terms2(w)) {
+            decref_terms2(w->lam);
+            w->lam = bod;
+            summarize_terms2(w);
+            return w;
+        }
+        res = mk_lam2(bod);
+        break;
+    case APP2:
+        // The head is a variable, or a numeral iterating a neutral term,
+        // so the spine needs no reduction.
+        fun = w->app->fun;
+        incref_terms2(fun);
+        fun = nf_whnf(fun, nfc);
+        arg = nf_terms2(w->app->arg, nfc);
+        res = fold_num2(fun, arg);
+        if (res) {decref_terms2(fun); decref_terms2(arg); break;}
+        if (fun == w->app->fun && arg == w->app->arg) {
+            decref_terms2(fun); decref_terms2(arg);
+            return w;
+        }
+        // The old children are only dropped now: while they live, the
+        // subterms they share count as such for the cache.
+        if (unique_terms2(w)) {
+            decref_terms2(w->app->fun); decref_terms2(w->app->arg);
+            w->app->fun = fun;
+            w->app->arg = arg;
+            summarize_terms2(w);
+            return w;
+        }
+        res = mk_app2(fun, arg);
+        break;
+    default:
+        return w;
+    }
+    decref_terms2(w);
+    return res;
+}
+
+static struct terms2 *nf_cached(struct terms2 *t, struct nfcaches *nfc)
+{
+    uint64_t h = hash_terms2(t);
+    if (fv_terms2(t)) {return nf_whnf(whnf_terms2(t), nfc);}
+    struct nfentries *e = lookup_nfcaches(nfc, t, h);
+    if (e) {
+        nfc->hits++;
+        incref_terms2(e->nf);
+        return e->nf;
+    }
+    nfc->misses++;
+    struct terms2 *nf = nf_whnf(whnf_terms2(t), nfc);
+    if (nf) {insert_nfcaches(nfc, t, h, nf);}
+    return nf;
+}
+
+//  Only shared subterms are worth looking up: those are the ones that
+//  stem from references to declarations, or from duplicating arguments.
+//  Nodes in a heap do not count their references, but `DEF2` nodes are
+//  shared by construction.
+static struct terms2 *nf_terms2(struct terms2 *t, struct nfcaches *nfc)
+{
+    if (nfc && !imm_terms2(t) && (t->refcnt > 1 || t->tag == DEF2)) {
+        return nf_cached(t, nfc);
+    }
+    return nf_whnf(whnf_terms2(t), nfc);
+}
+
+struct terms2 *normalize_terms2(struct terms2 *t, struct nfcaches *nfc)
+{
+    if (!t) {return NULL;}
+    if (nfc) {return nf_cached(t, nfc);}
+    return nf_whnf(whnf_terms2(t), nfc);
+}
+
+struct terms2 *mk_nfapp2(struct terms2 *fun, struct terms2 *arg)
+{
+    struct terms2 *res = fold_num2(fun, arg);
+    if (!res) {return mk_app2(fun, arg);}
+    decref_terms2(fun); decref_terms2(arg);
+    return res;
+}
+
+struct terms2 *mk_nflam2(struct terms2 *bod)
+{
+    struct terms2 *res = eta_num2(bod);
+    if (!res) {return mk_lam2(bod);}
+    decref_terms2(bod);
+    return res;
+}
+
+/* ***** ***** */
+
+//  Convertibility, by comparing weak head normal forms from the outside
+//  in. Neutral terms are compared as spines `(h a1 .. an)`, heads first
+//  and the last argument in the loop. Numerals iterating a neutral term
+//  are unfolded only as far as needed to line up with the other side.
+
+static int conv_aux(struct terms2 *a, struct terms2 *b);
+
+//  The head of the spine `t`, and its number of arguments.
+static struct terms2 *head_spine2(struct terms2 *t, size_t *n)
+{
+    for (*n = 0; tag_terms2(t) == APP2; t = t->app->fun) {(*n)++;}
+    return t;
+}
+
+//  The spine `t`, with its innermost iterate `((#n f) x)` replaced by
+//  `it` (consumed). Returns a new reference.
+static struct terms2 *respine2(struct terms2 *t, struct terms2 *it)
+{
+    if (is_iter2(t)) {return it;}
+    incref_terms2(t->app->arg);
+    return mk_app2(respine2(t->app->fun, it), t->app->arg);
+}
+
+//  Unfolds the innermost iterate of `t` to `(f ((#n-1 f) x))`, or to
+//  `x` if `n = 0`, if `m` is `0`; otherwise splits it, to
+//  `((#m f) ((#n-m f) x))`, `m < n`. Consumes `t`.
+static struct terms2 *unfold_iter2(struct terms2 *t, unsigned long m)
+{
+    struct terms2 *it = t;
+    while (!is_iter2(it)) {it = it->app->fun;}
+    unsigned long n = num_terms2(it->app->fun->app->fun);
+    struct terms2 *f = it->app->fun->app->arg, *x = it->app->arg;
+    incref_terms2(x);
+    if (n) {
+        incref_terms2(f); incref_terms2(f);
+        x = mk_app2(mk_app2(mk_num2(m ? n - m : n - 1), f), x);
+        it = m ? mk_app2(mk_app2(mk_num2(m), f), x) : mk_app2(f, x);
+    } else {
+        it = x;
+    }
+    struct terms2 *res = respine2(t, it);
+    decref_terms2(t);
+    return res;
+}
+
+//  `(t 0)`, with `t` shifted past the new binder. Consumes `t`.
+static struct terms2 *eta_expand2(struct terms2 *t)
+{
+    struct terms2 *res = mk_app2(shift_terms2(t, 1, 0), mk_var2(0));
+    decref_terms2(t);
+    return res;
+}
+
+//  Compares all arguments of two spines of equal length, but the last,
+//  their heads being known to be equal.
+static int conv_init(struct terms2 *a, struct terms2 *b)
+{
+    if (tag_terms2(a) != APP2) {return 1;}
+    if (!conv_init(a->app->fun, b->app->fun)) {return 0;}
+    incref_terms2(a->app->arg); incref_terms2(b->app->arg);
+    return conv_aux(a->app->arg, b->app->arg);
+}
+
+//  Consumes `a` and `b`.
+static int conv_aux(struct terms2 *a, struct terms2 *b)
+{
+    struct terms2 *ha, *hb, *t;
+    unsigned long n, m;
+    size_t na, nb;
+    int res = 1;
+    while (a != b) {
+        t = whnf_terms2(a); decref_terms2(a); a = t;
+        t = whnf_terms2(b); decref_terms2(b); b = t;
+        if (a == b) {break;}
+        if (tag_terms2(a) == LAM2 || tag_terms2(b) == LAM2) {
+            // `\a'` and `b` are convertible iff `a'` and `(b 0)` are.
+            a = tag_terms2(a) == LAM2 ? take_lam2(a) : eta_expand2(a);
+            b = tag_terms2(b) == LAM2 ? take_lam2(b) : eta_expand2(b);
+            continue;
+        }
+        if (tag_terms2(a) == NUM2 && tag_terms2(b) == NUM2) {
+            res = num_terms2(a) == num_terms2(b);
+            break;
+        }
+        ha = head_spine2(a, &na);
+        hb = head_spine2(b, &nb);
+        if ((tag_terms2(ha) == NUM2 && na < 2)
+                || (tag_terms2(hb) == NUM2 && nb < 2)) {
+            // `#n` and `(#n f)` are abstractions in disguise.
+            a = eta_expand2(a);
+            b = eta_expand2(b);
+            continue;
+        }
+        if (tag_terms2(ha) == NUM2 && tag_terms2(hb) == NUM2 && na == nb
+                                   && num_terms2(ha) != num_terms2(hb)) {
+            n = num_terms2(ha);
+            m = num_terms2(hb);
+            // `((#n f) x)` is `((#m f) ((#n-m f) x))`, so to line up with
+            // `((#m g) y)`.
+            if (!n) {
+                a = unfold_iter2(a, 0);
+            } else if (!m) {
+                b = unfold_iter2(b, 0);
+            } else if (n > m) {
+                a = unfold_iter2(a, m);
+            } else {
+                b = unfold_iter2(b, n);
+            }
+            continue;
+        }
+        if (tag_terms2(ha) != tag_terms2(hb) || na != nb) {
+            if (tag_terms2(ha) == NUM2) {a = unfold_iter2(a, 0); continue;}
+            if (tag_terms2(hb) == NUM2) {b = unfold_iter2(b, 0); continue;}
+            res = 0;
+            break;
+        }
+        if (tag_terms2(ha) == VAR2 && idx_terms2(ha) != idx_terms2(hb)) {
+            res = 0;
+            break;
+        }
+        if (!na) {break;}
+        if (!conv_init(a->app->fun, b->app->fun)) {res = 0; break;}
+        t = a->app->arg; incref_terms2(t); decref_terms2(a); a = t;
+        t = b->app->arg; incref_terms2(t); decref_terms2(b); b = t;
+    }
+    decref_terms2(a); decref_terms2(b);
+    return res;
+}
+
+int convertible_terms2(struct terms2 *a, struct terms2 *b)
+{
+    if (equal_terms2(a, b)) {return 1;}
+    incref_terms2(a); incref_terms2(b);
+    return conv_aux(a, b);
+}
+
+/* ***** ***** */
+
+//  Partial evaluation, bottom up: redexes are contracted when that can
+//  neither blow up the term nor duplicate work, abstractions are eta-
+//  contracted and numerals folded. Each node visited, and each redex
+//  contracted, costs a unit of `fuel`; once it has run out, subterms are
+//  left as they are. So it terminates, e.g. on `(\(0 0) \(0 0))`, in
+//  time linear in the fuel.
+
+#define SIMPLIFY_FUEL (1 << 16)
+
+//  The number of occurrences of the variable of index `k` in `t`, up to
+//  `2`, counting an occurrence under a lambda as `2` if `under`: the
+//  lambda may be applied any number of times.
+static unsigned int uses_terms2( struct terms2 *t, unsigned int k
+                               , int under, long *fuel)
+{
+    unsigned int n;
+    if (--*fuel < 0) {return 2;}
+    switch (tag_terms2(t)) {
+    case VAR2:
+        return idx_terms2(t) != k ? 0 : under == 2 ? 2 : 1;
+    case LAM2:
+        return uses_terms2(t->lam, k + 1, under ? 2 : 0, fuel);
+    case APP2:
+        n = uses_terms2(t->app->fun, k, under, fuel);
+        if (n < 2) {n += uses_terms2(t->app->arg, k, under, fuel);}
+        return n < 2 ? n : 2;
+    default:
+        return 0;
+    }
+}
+
+//  Whether to contract `(\bod arg)`: if `arg` is an atom, or a closed
+//  lambda (shared, not copied), or used at most once, and not under a
+//  lambda unless it is a value.
+static int inline_terms2(struct terms2 *bod, struct terms2 *arg, long *fuel)
+{
+    switch (tag_terms2(arg)) {
+    case VAR2:
+    case NUM2:
+    case DEF2:
+        return 1;
+    case LAM2:
+        return !free_terms2(arg) || uses_terms2(bod, 0, 0, fuel) < 2;
+    default:
+        return uses_terms2(bod, 0, 1, fuel) < 2;
+    }
+}
+
+static struct terms2 *simplify_aux(struct terms2 *t, long *fuel)
+{
+    struct terms2 *bod, *fun, *arg, *res;
+    unsigned long n;
+    if (--*fuel < 0) {incref_terms2(t); return t;}
+    switch (tag_terms2(t)) {
+    case LAM2:
+        bod = simplify_aux(t->lam, fuel);
+        // `\(f 0)` is `f`, if `f` does not use the variable.
+        if (tag_terms2(bod) == APP2 && tag_terms2(bod->app->arg) == VAR2
+                                    && idx_terms2(bod->app->arg) == 0
+                                    && !occurs_terms2(bod->app->fun, 0)) {
+            res = shift_terms2(bod->app->fun, -1, 0);
+            decref_terms2(bod);
+            return res;
+        }
+        if (bod == t->lam) {decref_terms2(bod); incref_terms2(t); bod = t;}
+        else {bod = mk_nflam2(bod);}
+        res = compact_terms2(bod);
+        decref_terms2(bod);
+        return res;
+    case APP2:
+        fun = simplify_aux(t->app->fun, fuel);
+        arg = simplify_aux(t->app->arg, fuel);
+        if (tag_terms2(fun) == LAM2 && inline_terms2(fun->lam, arg, fuel)
+                                    && --*fuel >= 0) {
+            bod = subst_own(take_lam2(fun), arg, 0);
+            decref_terms2(arg);
+            res = simplify_aux(bod, fuel);
+            decref_terms2(bod);
+            return res;
+        }
+        // `(#0 a)` is `\0` and `(#n #m)` is `#m^n`.
+        if (tag_terms2(fun) == NUM2 && (!num_terms2(fun)
+                || (tag_terms2(arg) == NUM2
+                 && pow_num2(num_terms2(arg), num_terms2(fun), &n)))) {
+            res = num_terms2(fun) ? mk_num2(n) : mk_lam2(mk_var2(0));
+            decref_terms2(fun); decref_terms2(arg);
+            return res;
+        }
+        if (fun == t->app->fun && arg == t->app->arg) {
+            decref_terms2(fun); decref_terms2(arg);
+            incref_terms2(t);
+            return t;
+        }
+        return mk_nfapp2(fun, arg);
+    default:
+        incref_terms2(t);
+        return t;
+    }
+}
+
+struct terms2 *simplify_terms2(struct terms2 *t)
+{
+    long fuel = SIMPLIFY_FUEL;
+    return simplify_aux(t, &fuel);
+}
+
@@ -0,0 +1,185 @@
+/**
+ *          ╔═══════════════╗
+ *          ║ NORMALIZATION ║
+ *          ╚═══════════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Normal order beta-reduction of de Bruijn encoded terms, and
+ *          a cache memoizing the normal forms of closed terms. The cache
+ *          is keyed by the structure of a term rather than by pointer,
+ *          so that it can be shared across the declarations of a
+ *          `contexts2`: every occurrence of (a term equal to) `two` is
+ *          normalized once. Its memory use is capped, least recently
+ *          used entries being evicted first.
+ *
+ *          Reduction consumes the redexes it contracts, and nodes it
+ *          holds the only reference to (e.g., the contractum of the
+ *          previous step) are rewritten in place rather than freed and
+ *          allocated anew; shared nodes are left intact.
+ */
+
+/* ***** ***** */
+
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+/* ***** ***** */
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lambda_parser.h"
+#include "heap.h"
+
+/* ***** ***** */
+
+
+/*********************************************************************/
+/*          STRUCTURAL IDENTITY                                      */
+/*********************************************************************/
+
+/**
+ * \brief   Hash of the structure of `t`, i.e., equal terms (in the
+ *          sense of `equal_terms2`) have equal hashes.
+ */
+uint64_t hash_terms2(struct terms2 *t);
+
+/**
+ * \brief   Structural (alpha-)equality of de Bruijn terms. Returns `1`
+ *          if equal, `0` otherwise.
+ */
+int equal_terms2(struct terms2 *a, struct terms2 *b);
+
+/**
+ * \brief   Returns the least `k` such that all free de Bruijn indexes
+ *          of `t` are `< k`; in particular `0` iff `t` is closed.
+ */
+unsigned int free_terms2(struct terms2 *t);
+
+
+/*********************************************************************/
+/*          REDUCTION                                                */
+/*********************************************************************/
+
+/**
+ * \brief   Adds `d` to all de Bruijn indexes of `t` that are `>= cut`.
+ *          Returns a new reference; unaffected subterms are shared
+ *          with `t`, not copied.
+ */
+struct terms2 *shift_terms2(struct terms2 *t, int d, unsigned int cut);
+
+/**
+ * \brief   Capture avoiding substitution of `arg` for the variable of
+ *          index `0` in `bod`, i.e., the contractum of the redex
+ *          `(\bod arg)`. Returns a new reference; frees neither input.
+ */
+struct terms2 *subst_terms2(struct terms2 *bod, struct terms2 *arg);
+
+/**
+ * \brief   If `t` is a Church numeral `\\(1 (1 ... (1 0)))`, returns
+ *          its compact form `#n`; otherwise another reference to `t`.
+ *          Normalization keeps numerals compact, so this is only needed
+ *          for Church numerals written out or built from scratch.
+ */
+struct terms2 *compact_terms2(struct terms2 *t);
+
+/**
+ * \brief   Weak head normal form of `t` (normal order). Returns a new
+ *          reference. Does not terminate if `t` has no whnf.
+ */
+struct terms2 *whnf_terms2(struct terms2 *t);
+
+/**
+ * \brief   Partially evaluates `t`, within a fixed budget of work: beta-
+ *          reduces the redexes whose argument is an atom or a closed
+ *          lambda, or is used at most once (and not under a lambda),
+ *          eta-contracts, and folds numerals (see `compact_terms2` and
+ *          `normalize_terms2`). The result is beta-eta-equivalent to `t`,
+ *          and returned as a new reference; `t` is borrowed. It is what
+ *          `CTX2_SIMPLIFY` stores for declarations.
+ */
+struct terms2 *simplify_terms2(struct terms2 *t);
+
+
+/*********************************************************************/
+/*          NORMAL FORM CACHE                                        */
+/*********************************************************************/
+
+/**
+ * \brief   Maps closed terms to their normal forms, with a cap on the
+ *          (estimated) number of bytes held by its entries.
+ */
+struct nfcaches;
+
+struct nfstats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+};
+
+/**
+ * \brief   Allocates an empty cache whose entries may use at most `cap`
+ *          bytes in total.
+ */
+struct nfcaches *alloc_nfcaches(size_t cap);
+
+/**
+ * \brief   Frees the cache and drops its references to the cached
+ *          terms and normal forms.
+ */
+void free_nfcaches(struct nfcaches *nfc);
+
+/**
+ * \brief   Returns the counters of `nfc`.
+ */
+struct nfstats stats_nfcaches(struct nfcaches *nfc);
+
+/**
+ * \brief   A `scanners` for the terms held by a `nfcaches`, for caches
+ *          used with a heap.
+ */
+void scan_nfcaches(void *nfc, visitors v, void *env);
+
+/**
+ * \brief   Normal form of `t` (normal order), returned as a new
+ *          reference. If `nfc` is not `NULL` it is consulted for, and
+ *          populated with, the normal forms of `t` and of its shared
+ *          closed subterms. Does not terminate if `t` has no normal
+ *          form. Numerals iterating a neutral term are not unfolded, so
+ *          the result may contain `((#n f) x)`, standing for the normal
+ *          form `(f (f .. (f x)))`.
+ */
+struct terms2 *normalize_terms2(struct terms2 *t, struct nfcaches *nfc);
+
+/**
+ * \brief   Constructors of normal forms from normal forms, `(fun arg)`
+ *          and `\bod`, folding iterates of neutral terms into numerals
+ *          the way `normalize_terms2` does. They take ownership of the
+ *          references passed to them.
+ */
+struct terms2 *mk_nfapp2(struct terms2 *fun, struct terms2 *arg);
+struct terms2 *mk_nflam2(struct terms2 *bod);
+
+
+/*********************************************************************/
+/*          CONVERTIBILITY                                           */
+/*********************************************************************/
+
+/**
+ * \brief   Beta-eta convertibility of `a` and `b` (which are borrowed):
+ *          returns `1` if they have the same normal form up to eta, `0`
+ *          otherwise. Structurally equal terms are accepted outright.
+ *          Otherwise both are reduced to weak head normal form only, and
+ *          their heads compared, before going on to the arguments (and
+ *          bodies), so that a mismatch is found without normalizing the
+ *          rest. Does not terminate if the parts compared have no normal
+ *          form.
+ */
+int convertible_terms2(struct terms2 *a, struct terms2 *b);
+
+/* ***** ***** */
+
+#endif // NORMALIZE_H
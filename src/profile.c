@@ -0,0 +1,276 @@
+/*
+    ╔═══════════╗
+    ║ PROFILING ║
+    ╚═══════════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "lambda_terms.h"
+#include "profile.h"
+
+/* ***** ***** */
+
+//  The call paths form a tree, each path but `MAIN` (index `0`) being
+//  its caller `up` extended by the declaration of index `cc - 1`. They
+//  are interned by an open addressing table from `(up, cc)` to their
+//  index plus one. Indexes must fit the `ccs` field of `terms2`.
+
+#define CCS_MAX (1u << 24)
+
+struct frames {
+    unsigned int up;
+    unsigned int cc;
+    size_t steps;
+    size_t allocs;
+    uint64_t nanos;
+};
+
+struct profiles {
+    struct contexts2 *ctx;
+    unsigned int cur;   // The stack of the nodes being built.
+    unsigned int last;  // The path of the last step, charged the time.
+    uint64_t clock;     // The time of the last step.
+    size_t cap;
+    size_t num;
+    struct frames *els;
+    size_t hcap;        // A power of two, or zero.
+    unsigned int *index;
+};
+
+_Thread_local struct profiles *cur_profiles;
+
+static uint64_t nanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* ***** ***** */
+
+struct profiles *alloc_profiles(struct contexts2 *ctx)
+{
+    struct profiles *p = malloc(sizeof(struct profiles));
+    MALCHECK(p);
+    struct frames *els = malloc(64 * sizeof(struct frames));
+    if (!els) {free(p);}
+    MALCHECK(els);
+    els[0] = (struct frames) {.up = 0, .cc = 0};
+    *p = (struct profiles) { .ctx = ctx, .clock = nanos()
+                           , .cap = 64, .num = 1, .els = els };
+    return p;
+}
+
+void free_profiles(struct profiles *p)
+{
+    if (!p) {return;}
+    if (cur_profiles == p) {cur_profiles = NULL;}
+    free(p->els);
+    free(p->index);
+    free(p);
+}
+
+struct profiles *use_profiles(struct profiles *p)
+{
+    struct profiles *prev = cur_profiles;
+    cur_profiles = p;
+    if (p) {p->clock = nanos();}
+    return prev;
+}
+
+/* ***** ***** */
+
+//  Interning of paths.
+
+static size_t hash_frames(unsigned int up, unsigned int cc, size_t cap)
+{
+    uint64_t h = ((uint64_t) up << 32 | cc) * 0x9e3779b97f4a7c15ull;
+    return (size_t) (h >> 32) & (cap - 1);
+}
+
+static int grow_index(struct profiles *p)
+{
+    size_t hcap = p->hcap ? 2 * p->hcap : 64;
+    unsigned int *index = calloc(hcap, sizeof(unsigned int));
+    if (!index) {
+        fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        return 0;
+    }
+    for (size_t s = 1; s < p->num; s++) {
+        size_t i = hash_frames(p->els[s].up, p->els[s].cc, hcap);
+        while (index[i]) {i = (i + 1) & (hcap - 1);}
+        index[i] = s + 1;
+    }
+    free(p->index);
+    p->index = index;
+    p->hcap = hcap;
+    return 1;
+}
+
+//  The path `up` extended by `cc`, or cut back to the visit of `cc` on
+//  it if any. Stays at `up` if out of paths (or memory).
+static unsigned int push_frames( struct profiles *p, unsigned int up
+                                                   , unsigned int cc)
+{
+    if (!cc) {return up;}
+    for (unsigned int s = up; s; s = p->els[s].up) {
+        if (p->els[s].cc == cc) {return s;}
+    }
+    size_t i = 0;
+    if (p->hcap) {
+        i = hash_frames(up, cc, p->hcap);
+        for (; p->index[i]; i = (i + 1) & (p->hcap - 1)) {
+            struct frames *f = &p->els[p->index[i] - 1];
+            if (f->up == up && f->cc == cc) {return p->index[i] - 1;}
+        }
+    }
+    if (p->num >= CCS_MAX) {return up;}
+    if (p->num == p->cap) {
+        size_t cap = ((p->cap)*3)/2 + 8;
+        struct frames *els = realloc(p->els, cap * sizeof(struct frames));
+        if (!els) {
+            fprintf(stderr, "Failed realloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return up;
+        }
+        p->els = els;
+        p->cap = cap;
+    }
+    if (2 * (p->num + 1) > p->hcap) {
+        if (!grow_index(p)) {return up;}
+        i = hash_frames(up, cc, p->hcap);
+        while (p->index[i]) {i = (i + 1) & (p->hcap - 1);}
+    }
+    p->els[p->num] = (struct frames) {.up = up, .cc = cc};
+    p->index[i] = p->num + 1;
+    return p->num++;
+}
+
+/* ***** ***** */
+
+//  Hooks.
+
+unsigned int alloc_ccs_profiles(struct profiles *p)
+{
+    p->els[p->cur].allocs++;
+    return p->cur;
+}
+
+unsigned int set_ccs_profiles(struct profiles *p, unsigned int ccs)
+{
+    unsigned int prev = p->cur;
+    p->cur = ccs;
+    return prev;
+}
+
+unsigned int enter_ccs_profiles(struct profiles *p, size_t idx)
+{
+    return set_ccs_profiles(p, push_frames(p, 0, idx + 1));
+}
+
+unsigned int step_ccs_profiles( struct profiles *p, unsigned int app
+                                                  , unsigned int fun)
+{
+    unsigned int s = push_frames(p, app, fun ? p->els[fun].cc : 0);
+    uint64_t now = nanos();
+    p->els[p->last].nanos += now - p->clock;
+    p->els[s].steps++;
+    p->clock = now;
+    p->last = s;
+    return set_ccs_profiles(p, s);
+}
+
+/* ***** ***** */
+
+//  Reports.
+
+static void fputs_cc(FILE *out, struct profiles *p, unsigned int cc)
+{
+    if (!cc) {fputs("MAIN", out); return;}
+    struct slices x = p->ctx->els[cc - 1].nam;
+    fprintf(out, "%.*s", (int) x.len, x.str);
+}
+
+static void fputs_frames(FILE *out, struct profiles *p, unsigned int s)
+{
+    if (s) {
+        fputs_frames(out, p, p->els[s].up);
+        putc(';', out);
+    }
+    fputs_cc(out, p, p->els[s].cc);
+}
+
+void fprintf_folded_profiles(FILE *out, struct profiles *p)
+{
+    for (size_t s = 0; s < p->num; s++) {
+        if (!p->els[s].steps) {continue;}
+        fputs_frames(out, p, s);
+        fprintf(out, " %zu\n", p->els[s].steps);
+    }
+}
+
+struct totals {
+    unsigned int cc;
+    size_t steps;
+    size_t allocs;
+    uint64_t nanos;
+    size_t inherited;
+};
+
+static int cmp_totals(const void *a, const void *b)
+{
+    const struct totals *x = a, *y = b;
+    if (x->steps != y->steps) {return x->steps < y->steps ? 1 : -1;}
+    return x->cc < y->cc ? -1 : x->cc > y->cc;
+}
+
+void fprintf_top_profiles(FILE *out, struct profiles *p, size_t n)
+{
+    size_t ncc = 1, steps = 0, allocs = 0;
+    uint64_t time = 0;
+    for (size_t s = 0; s < p->num; s++) {
+        if (p->els[s].cc >= ncc) {ncc = p->els[s].cc + 1;}
+    }
+    struct totals *tot = calloc(ncc, sizeof(struct totals));
+    if (!tot) {
+        fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        return;
+    }
+    for (size_t cc = 0; cc < ncc; cc++) {tot[cc].cc = cc;}
+    for (size_t s = 0; s < p->num; s++) {
+        struct frames *f = &p->els[s];
+        tot[f->cc].steps += f->steps;
+        tot[f->cc].allocs += f->allocs;
+        tot[f->cc].nanos += f->nanos;
+        steps += f->steps;
+        allocs += f->allocs;
+        time += f->nanos;
+        // A path visits each declaration at most once.
+        for (unsigned int u = s; ; u = p->els[u].up) {
+            tot[p->els[u].cc].inherited += f->steps;
+            if (!u) {break;}
+        }
+    }
+    qsort(tot, ncc, sizeof(struct totals), cmp_totals);
+    fprintf(out, "profile: %zu steps, %zu allocations, %.3f s.\n"
+               , steps, allocs, time * 1e-9);
+    fprintf(out, "%10s %6s %10s %9s %10s  %s\n"
+               , "steps", "%", "allocs", "ms", "in paths", "definition");
+    for (size_t i = 0; i < ncc && i < n && tot[i].steps; i++) {
+        fprintf( out, "%10zu %5.1f%% %10zu %9.3f %10zu  "
+               , tot[i].steps, steps ? 100.0 * tot[i].steps / steps : 0.0
+               , tot[i].allocs, tot[i].nanos * 1e-6, tot[i].inherited);
+        fputs_cc(out, p, tot[i].cc);
+        putc('\n', out);
+    }
+    free(tot);
+}
@@ -0,0 +1,106 @@
+/**
+ *          ╔═══════════╗
+ *          ║ PROFILING ║
+ *          ╚═══════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Cost centre profiling of `normalize_terms2`, each `@`
+ *          declaration being a cost centre. While a profile is in use
+ *          (see `use_profiles`) by a thread, every `terms2` node it
+ *          builds is tagged with a cost centre stack, i.e., a call path:
+ *          nodes parsed in the body of a declaration with that
+ *          declaration alone, and those built by a beta step with the
+ *          path the step is charged to. That is the path of the
+ *          application contracted, extended by the declaration the
+ *          lambda stems from; a path that would visit a declaration twice
+ *          (recursion) is cut back to its first visit instead, so that
+ *          paths stay finite.
+ *
+ *          Each path counts the beta (and numeral) steps charged to it,
+ *          the nodes built under it (also those rebuilt in place), and
+ *          the time until the next step. Reductions by `gmachine.h`, or
+ *          by other threads, are not profiled.
+ */
+
+/* ***** ***** */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/* ***** ***** */
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "lambda_parser.h"
+
+/* ***** ***** */
+
+struct profiles;
+
+/**
+ * \brief   Allocates an empty profile of the declarations of `ctx`,
+ *          which must outlive it.
+ */
+struct profiles *alloc_profiles(struct contexts2 *ctx);
+
+void free_profiles(struct profiles *p);
+
+/**
+ * \brief   Makes `p` the profile that the calling thread charges its
+ *          reductions to, or none if `NULL`. Returns the one previously
+ *          in use.
+ */
+struct profiles *use_profiles(struct profiles *p);
+
+/**
+ * \brief   Prints the steps of each call path as a line
+ *          `MAIN;name;...;name steps`, the folded stack format read by
+ *          flamegraph tools. `MAIN` stands for the undeclared terms.
+ */
+void fprintf_folded_profiles(FILE *out, struct profiles *p);
+
+/**
+ * \brief   Prints the totals, and the `n` declarations with the most
+ *          steps: their own steps, allocations and time, summed over
+ *          the paths ending in them, and the steps of all paths through
+ *          them.
+ */
+void fprintf_top_profiles(FILE *out, struct profiles *p, size_t n);
+
+/* ***** ***** */
+
+//  Hooks of the parser, the constructors and the reducer, for the
+//  profile in use. A cost centre stack is an index into the paths of
+//  `p`, `0` being `MAIN`.
+
+/**
+ * \brief   Counts a node allocated, returning the stack to tag it with.
+ */
+unsigned int alloc_ccs_profiles(struct profiles *p);
+
+/**
+ * \brief   Makes `ccs` that of the nodes built from now on. Returns the
+ *          previous one.
+ */
+unsigned int set_ccs_profiles(struct profiles *p, unsigned int ccs);
+
+/**
+ * \brief   Enters the body of the declaration of index `idx`, i.e.,
+ *          `set_ccs_profiles` to its own stack.
+ */
+unsigned int enter_ccs_profiles(struct profiles *p, size_t idx);
+
+/**
+ * \brief   Charges a step contracting the application tagged `app` by a
+ *          function tagged `fun` (`0` for a numeral), and makes the path
+ *          it is charged to that of the nodes built from now on. Returns
+ *          the previous one.
+ */
+unsigned int step_ccs_profiles( struct profiles *p, unsigned int app
+                                                  , unsigned int fun);
+
+/* ***** ***** */
+
+#endif // PROFILE_H
@@ -0,0 +1,494 @@
+/*
+    ╔════════╗
+    ║ SERVER ║
+    ╚════════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "lambda_terms.h"
+#include "normalize.h"
+#include "heap.h"
+#include "server.h"
+
+/* ***** ***** */
+
+#define MAX_FRAME (64u << 20)
+#define REQ_HEAP_BLOCK (1 << 16)
+#define REQ_NFCACHE_CAP (16 << 20)
+
+//  Frames.
+
+//  The connections are non-blocking, for the event loop, so a reply
+//  larger than the socket buffer is written as the peer drains it.
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {continue;}
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {return 0;}
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {return 0;}
+            continue;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int read_all(int fd, char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) {continue;}
+        if (n <= 0) {return 0;}
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+//  Writes the frame of `head` followed by `buf[0..len)`.
+static int write_frame(int fd, char head, const char *buf, size_t len)
+{
+    uint32_t n = htonl(len + 1);
+    char hdr[5];
+    memcpy(hdr, &n, 4);
+    hdr[4] = head;
+    return write_all(fd, hdr, 5) && write_all(fd, buf, len);
+}
+
+/* ***** ***** */
+
+//  Jobs: the complete requests read by the event loop, queued for the
+//  workers.
+
+struct jobs {
+    int fd;
+    size_t len;
+    struct jobs *next;
+    char buf[];
+};
+
+struct servers {
+    struct contexts2 *ctx;
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    struct jobs *head;
+    struct jobs *tail;
+    int stop;
+    int wake[2]; // Fds of the connections that workers are done with.
+};
+
+static void push_jobs(struct servers *s, struct jobs *j)
+{
+    j->next = NULL;
+    pthread_mutex_lock(&s->mtx);
+    if (s->tail) {s->tail->next = j;} else {s->head = j;}
+    s->tail = j;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mtx);
+}
+
+//  Blocks until there is a job, or returns `NULL` when stopping.
+static struct jobs *pop_jobs(struct servers *s)
+{
+    pthread_mutex_lock(&s->mtx);
+    while (!s->head && !s->stop) {pthread_cond_wait(&s->cond, &s->mtx);}
+    struct jobs *j = s->head;
+    if (j) {
+        s->head = j->next;
+        if (!s->head) {s->tail = NULL;}
+    }
+    pthread_mutex_unlock(&s->mtx);
+    return j;
+}
+
+/* ***** ***** */
+
+//  Workers. Each has its own copy of the context (sharing the terms,
+//  which are not reference counted), to which the declarations of a
+//  request are added and from which they are dropped afterwards, and
+//  builds the terms of a request in a heap of its own, freed afterwards.
+
+struct workers {
+    struct servers *srv;
+    struct contexts2 *ctx;
+    struct names *xs;
+    pthread_t thread;
+};
+
+static struct contexts2 *copy_contexts2(struct contexts2 *ctx)
+{
+    struct contexts2 *cpy = alloc_contexts2(ctx->num + 64);
+    memcpy(cpy->els, ctx->els, sizeof(struct binds2) * ctx->num);
+    cpy->num = ctx->num;
+    // The `ref`s of `ctx` cannot be created lazily by several threads.
+    cpy->flags = ctx->flags & ~CTX2_DEFS;
+    return cpy;
+}
+
+static void handle_jobs(struct workers *w, struct jobs *j)
+{
+    unsigned int flags = (unsigned char) j->buf[0];
+    struct heaps *h = alloc_heaps(REQ_HEAP_BLOCK);
+    use_heaps(h);
+    struct nfcaches *nfc = flags & REQ_NORMALIZE
+                         ? alloc_nfcaches(REQ_NFCACHE_CAP) : NULL;
+    struct sources *src = alloc_sources_str(j->buf + 1, j->len - 1);
+    size_t base = w->ctx->num;
+    char *out = NULL;
+    size_t len = 0;
+    FILE *mem = open_memstream(&out, &len);
+    int ok = mem != NULL;
+    while (ok && !parse_eof(src)) {
+        struct terms2 *t = parse_declterms2(src, w->xs, w->ctx);
+        if (!t) {ok = 0; break;}
+        if (nfc) {
+            struct terms2 *nf = normalize_terms2(t, nfc);
+            decref_terms2(t);
+            t = compact_terms2(nf);
+            decref_terms2(nf);
+        }
+        if (flags & REQ_NAMED) {
+            fprintf_named_terms2(mem, t, w->xs);
+        } else {
+            fprintf_terms2(mem, t);
+        }
+        putc_unlocked('\n', mem);
+        clear_names(w->xs);
+        decref_terms2(t);
+    }
+    clear_names(w->xs);
+    if (mem) {fclose(mem);}
+    if (ok) {
+        write_frame(j->fd, 0, out, len);
+    } else {
+        char msg[64];
+        int n = snprintf(msg, sizeof(msg), "parse error at byte %zu.\n"
+                                         , src->pos);
+        write_frame(j->fd, 1, msg, n);
+    }
+    free(out);
+    while (w->ctx->num > base) {
+        w->ctx->num--;
+        free_slices(w->ctx->els[w->ctx->num].nam);
+    }
+    free_sources(src);
+    free_nfcaches(nfc);
+    use_heaps(NULL);
+    free_heaps(h);
+}
+
+static void *run_workers(void *arg)
+{
+    struct workers *w = arg;
+    struct jobs *j;
+    while ((j = pop_jobs(w->srv))) {
+        handle_jobs(w, j);
+        int fd = j->fd;
+        free(j);
+        if (write(w->srv->wake[1], &fd, sizeof(fd)) < 0) {
+            perror("write");
+        }
+    }
+    return NULL;
+}
+
+/* ***** ***** */
+
+//  The event loop. A connection is not polled while a worker handles
+//  one of its requests, so its requests are handled one at a time.
+//  `SIGINT` and `SIGTERM` are blocked in the workers and, in the loop,
+//  written to a pipe that is polled with the connections, so that a
+//  signal arriving just before `poll` still wakes it.
+
+struct conns {
+    int fd;
+    int busy;
+    size_t len;
+    size_t cap;
+    char *buf;
+};
+
+static volatile sig_atomic_t stopping;
+static int sigwake = -1;
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    int err = errno;
+    stopping = 1;
+    ssize_t n = write(sigwake, "", 1); // If full, `poll` wakes anyway.
+    (void) n;
+    errno = err;
+}
+
+static void close_conns(struct conns *c)
+{
+    close(c->fd);
+    free(c->buf);
+    c->fd = -1;
+}
+
+//  Queues the first request buffered in `c`, if complete. Returns `0`
+//  on a malformed frame.
+static int dispatch_conns(struct servers *s, struct conns *c)
+{
+    if (c->busy || c->len < 4) {return 1;}
+    uint32_t n;
+    memcpy(&n, c->buf, 4);
+    n = ntohl(n);
+    if (n == 0 || n > MAX_FRAME) {return 0;}
+    if (c->len < 4 + (size_t) n) {return 1;}
+    struct jobs *j = malloc(sizeof(struct jobs) + n);
+    if (!j) {return 0;}
+    j->fd = c->fd;
+    j->len = n;
+    memcpy(j->buf, c->buf + 4, n);
+    c->len -= 4 + n;
+    memmove(c->buf, c->buf + 4 + n, c->len);
+    c->busy = 1;
+    push_jobs(s, j);
+    return 1;
+}
+
+//  Reads what is available on `c`. Returns `0` if the connection is
+//  closed or broken.
+static int read_conns(struct conns *c)
+{
+    if (c->len == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 4096;
+        char *tmp = realloc(c->buf, cap);
+        if (!tmp) {return 0;}
+        c->buf = tmp;
+        c->cap = cap;
+    }
+    ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len);
+    if (n < 0) {return errno == EINTR || errno == EAGAIN;}
+    c->len += n;
+    return n > 0;
+}
+
+static int listen_servers(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s too long.\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {perror("socket"); return -1;}
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0
+        || listen(fd, 64) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+int serve_contexts2(const char *path, struct contexts2 *ctx
+                                    , size_t nworkers)
+{
+    int lfd = listen_servers(path);
+    if (lfd < 0) {return 0;}
+    struct servers s = {.ctx = ctx};
+    int sigp[2];
+    if (pipe(s.wake) < 0) {perror("pipe"); close(lfd); return 0;}
+    if (pipe(sigp) < 0) {
+        perror("pipe");
+        close(lfd); close(s.wake[0]); close(s.wake[1]);
+        return 0;
+    }
+    fcntl(sigp[0], F_SETFL, O_NONBLOCK);
+    fcntl(sigp[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&s.mtx, NULL);
+    pthread_cond_init(&s.cond, NULL);
+    if (nworkers == 0) {nworkers = 1;}
+    struct workers *ws = calloc(nworkers, sizeof(struct workers));
+    if (!ws) {
+        fprintf(stderr, "Malloc failed at line %d in `%s`.\n"
+                      , __LINE__, __FUNCTION__);
+        close(lfd); close(s.wake[0]); close(s.wake[1]);
+        close(sigp[0]); close(sigp[1]);
+        return 0;
+    }
+    sigset_t sigs, oldsigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+    sigwake = sigp[1];
+    struct sigaction sa = {.sa_handler = on_signal}, oldint, oldterm;
+    sigaction(SIGINT, &sa, &oldint);
+    sigaction(SIGTERM, &sa, &oldterm);
+    for (size_t i = 0; i < nworkers; i++) {
+        ws[i] = (struct workers) { .srv = &s, .ctx = copy_contexts2(ctx)
+                                 , .xs = alloc_names(64) };
+        pthread_create(&ws[i].thread, NULL, run_workers, &ws[i]);
+    }
+    // The workers inherit the blocked signals; only this thread takes them.
+    pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+    size_t nconns = 0, capconns = 0;
+    struct conns *conns = NULL;
+    struct pollfd *pfds = NULL;
+    size_t *idx = NULL; // Index into `conns` of each polled connection.
+    while (!stopping) {
+        size_t np = 3;
+        struct pollfd *tmp = realloc( pfds
+                                    , sizeof(struct pollfd) * (nconns + 3));
+        size_t *tmpi = realloc(idx, sizeof(size_t) * (nconns + 3));
+        if (tmp) {pfds = tmp;}
+        if (tmpi) {idx = tmpi;}
+        if (!tmp || !tmpi) {break;}
+        pfds[0] = (struct pollfd) {.fd = lfd, .events = POLLIN};
+        pfds[1] = (struct pollfd) {.fd = s.wake[0], .events = POLLIN};
+        pfds[2] = (struct pollfd) {.fd = sigp[0], .events = POLLIN};
+        for (size_t i = 0; i < nconns; i++) {
+            if (conns[i].busy) {continue;}
+            pfds[np] = (struct pollfd) { .fd = conns[i].fd
+                                       , .events = POLLIN };
+            idx[np++] = i;
+        }
+        if (poll(pfds, np, -1) < 0) {
+            if (errno == EINTR) {continue;}
+            perror("poll");
+            break;
+        }
+        if (pfds[2].revents & POLLIN) {
+            char drain[64];
+            while (read(sigp[0], drain, sizeof(drain)) > 0) {}
+            continue;
+        }
+        if (pfds[1].revents & POLLIN) {
+            int fd;
+            if (read(s.wake[0], &fd, sizeof(fd)) == sizeof(fd)) {
+                for (size_t i = 0; i < nconns; i++) {
+                    if (conns[i].fd != fd) {continue;}
+                    conns[i].busy = 0;
+                    if (!dispatch_conns(&s, &conns[i])) {
+                        close_conns(&conns[i]);
+                    }
+                }
+            }
+        }
+        for (size_t k = 3; k < np; k++) {
+            struct conns *c = &conns[idx[k]];
+            if (!pfds[k].revents || c->fd < 0 || c->busy) {continue;}
+            if (!read_conns(c) || !dispatch_conns(&s, c)) {close_conns(c);}
+        }
+        size_t m = 0;
+        for (size_t i = 0; i < nconns; i++) {
+            if (conns[i].fd >= 0) {conns[m++] = conns[i];}
+        }
+        nconns = m;
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept(lfd, NULL, NULL);
+            if (fd >= 0) {
+                if (nconns == capconns) {
+                    size_t cap = capconns * 2 + 8;
+                    struct conns *tmpc = realloc( conns
+                                                , sizeof(struct conns) * cap);
+                    if (!tmpc) {close(fd); continue;}
+                    conns = tmpc;
+                    capconns = cap;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                conns[nconns++] = (struct conns) {.fd = fd};
+            }
+        }
+    }
+
+    pthread_mutex_lock(&s.mtx);
+    s.stop = 1;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.mtx);
+    for (size_t i = 0; i < nworkers; i++) {
+        pthread_join(ws[i].thread, NULL);
+        ws[i].ctx->num = 0; // Only views of the terms and names of `ctx`.
+        free_contexts2(ws[i].ctx);
+        free_names(ws[i].xs);
+    }
+    while (s.head) {
+        struct jobs *j = s.head;
+        s.head = j->next;
+        free(j);
+    }
+    for (size_t i = 0; i < nconns; i++) {close_conns(&conns[i]);}
+    free(conns); free(pfds); free(idx); free(ws);
+    close(s.wake[0]); close(s.wake[1]);
+    close(lfd);
+    unlink(path);
+    pthread_mutex_destroy(&s.mtx);
+    pthread_cond_destroy(&s.cond);
+    sigaction(SIGINT, &oldint, NULL);
+    sigaction(SIGTERM, &oldterm, NULL);
+    sigwake = -1;
+    close(sigp[0]); close(sigp[1]);
+    stopping = 0;
+    return 1;
+}
+
+/* ***** ***** */
+
+//  Clients.
+
+int connect_servers(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s too long.\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {perror("socket"); return -1;}
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int request_servers(int fd, unsigned int flags, const char *src, size_t len
+                          , char **reply, size_t *rlen)
+{
+    if (len + 1 > MAX_FRAME) {return -1;}
+    if (!write_frame(fd, (char) flags, src, len)) {return -1;}
+    uint32_t n;
+    if (!read_all(fd, (char*) &n, 4)) {return -1;}
+    n = ntohl(n);
+    if (n == 0 || n > MAX_FRAME) {return -1;}
+    char *buf = malloc(n);
+    if (!buf) {return -1;}
+    if (!read_all(fd, buf, n)) {free(buf); return -1;}
+    int status = buf[0];
+    memmove(buf, buf + 1, n - 1);
+    buf[n - 1] = '\0';
+    *reply = buf;
+    *rlen = n - 1;
+    return status == 0;
+}
@@ -0,0 +1,73 @@
+/**
+ *          ╔════════╗
+ *          ║ SERVER ║
+ *          ╚════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Serves parse and normalize requests over a Unix domain
+ *          socket, against a context loaded once. A `poll` loop reads
+ *          the requests and a pool of threads handles them, so that one
+ *          slow request does not hold up the others.
+ *
+ *          Requests and replies are frames: a 4 byte length, in network
+ *          byte order, followed by that many bytes of payload. The
+ *          payload of a request is a byte of `REQ_*` flags followed by
+ *          source code, that of a reply a status byte (`0` on success)
+ *          followed by the terms, one per line, or an error message.
+ *          The requests on one connection are handled in order.
+ *
+ *          The source of a request may declare names with `@`, but they
+ *          are only visible within that request.
+ */
+
+/* ***** ***** */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/* ***** ***** */
+
+#include <stddef.h>
+
+#include "lambda_parser.h"
+
+/* ***** ***** */
+
+/**
+ * \brief   Flags of a request: print normal forms rather than parsed
+ *          terms, and print them with names rather than indexes.
+ */
+enum {REQ_NORMALIZE = 1, REQ_NAMED = 2};
+
+/**
+ * \brief   Listens on a new socket at `path` and handles requests with
+ *          `nworkers` threads until interrupted (`SIGINT` or `SIGTERM`).
+ *          The terms of `ctx` are shared by the threads, so they must
+ *          not be reference counted: load `ctx` with a heap in use, and
+ *          neither collect nor free that heap while serving. Nor may it
+ *          hold declarations pending from `index_declterms2`. Returns
+ *          `1` after a clean shutdown, `0` if the socket cannot be set up.
+ */
+int serve_contexts2(const char *path, struct contexts2 *ctx
+                                    , size_t nworkers);
+
+/**
+ * \brief   Connects to a server at `path`. Returns a file descriptor,
+ *          or `-1` on failure.
+ */
+int connect_servers(const char *path);
+
+/**
+ * \brief   Sends the request `(flags, src[0..len))` on the connection
+ *          `fd` and waits for the reply, whose text is stored, NUL-
+ *          terminated, in `*reply` (to be `free`d by the caller), and its
+ *          length in `*rlen`. Returns `1` if the request succeeded, `0`
+ *          if it failed and `-1` if the connection did.
+ */
+int request_servers(int fd, unsigned int flags, const char *src, size_t len
+                          , char **reply, size_t *rlen);
+
+/* ***** ***** */
+
+#endif // SERVER_H
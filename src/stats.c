@@ -0,0 +1,203 @@
+/*
+    ╔════════════╗
+    ║ STATISTICS ║
+    ╚════════════╝
+
+*/
+
+/* ***** ***** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "lambda_terms.h"
+#include "stats.h"
+
+/* ***** ***** */
+
+//  The visited set: an open addressing table from nodes to the size and
+//  depth of the tree below them, so that shared nodes are walked once.
+
+struct marks {
+    const void *key;
+    size_t size;
+    size_t depth;
+};
+
+struct visits {
+    size_t cap; // A power of two, or zero.
+    size_t num;
+    struct marks *els;
+};
+
+static size_t hash_ptr(const void *p, size_t cap)
+{
+    uint64_t h = (uint64_t) (uintptr_t) p >> 3;
+    h *= 0x9e3779b97f4a7c15ull;
+    return (size_t) (h >> 32) & (cap - 1);
+}
+
+static struct marks *find_visits(struct visits *vs, const void *key)
+{
+    if (!vs->cap) {return NULL;}
+    for (size_t i = hash_ptr(key, vs->cap); ; i = (i + 1) & (vs->cap - 1)) {
+        if (vs->els[i].key == key) {return &vs->els[i];}
+        if (!vs->els[i].key) {return NULL;}
+    }
+}
+
+static int add_visits(struct visits *vs, const void *key
+                                       , size_t size, size_t depth)
+{
+    if (2 * (vs->num + 1) > vs->cap) {
+        size_t cap = vs->cap ? 2 * vs->cap : 64;
+        struct marks *els = calloc(cap, sizeof(struct marks));
+        if (!els) {
+            fprintf(stderr, "Failed calloc at line %d in `%s`.\n"
+                          , __LINE__, __FUNCTION__);
+            return -1;
+        }
+        for (size_t j = 0; j < vs->cap; j++) {
+            if (!vs->els[j].key) {continue;}
+            size_t i = hash_ptr(vs->els[j].key, cap);
+            while (els[i].key) {i = (i + 1) & (cap - 1);}
+            els[i] = vs->els[j];
+        }
+        free(vs->els);
+        vs->els = els;
+        vs->cap = cap;
+    }
+    size_t i = hash_ptr(key, vs->cap);
+    while (vs->els[i].key) {i = (i + 1) & (vs->cap - 1);}
+    vs->els[i] = (struct marks) {.key = key, .size = size, .depth = depth};
+    vs->num++;
+    return 0;
+}
+
+static size_t add_sat(size_t a, size_t b)
+{
+    return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+static size_t max_size(size_t a, size_t b)
+{
+    return a > b ? a : b;
+}
+
+/* ***** ***** */
+
+//  Each walk stores the tree size and depth of `t` in `*size` and
+//  `*depth`, accumulating the other statistics in `st` for the nodes not
+//  visited before. Returns `-1` if the visited set cannot grow, `0`
+//  otherwise.
+
+static int walk_terms1( struct terms1 *t, struct visits *vs
+                      , struct termstats *st, size_t *size, size_t *depth)
+{
+    struct marks *m = find_visits(vs, t);
+    if (m) {*size = m->size; *depth = m->depth; return 0;}
+    size_t s1 = 0, s2 = 0, d1 = 0, d2 = 0;
+    st->nodes++;
+    st->bytes += sizeof(struct terms1);
+    switch (t->tag) {
+    case VAR1:
+        st->vars++;
+        if (t->var.own) {st->bytes += t->var.len + 1;}
+        break;
+    case NUM1:
+        st->nums++;
+        break;
+    case LAM1:
+        st->lams++;
+        st->bytes += sizeof(struct lams1);
+        if (t->lam->var.own) {st->bytes += t->lam->var.len + 1;}
+        if (walk_terms1(t->lam->bod, vs, st, &s1, &d1)) {return -1;}
+        break;
+    case APP1:
+        st->apps++;
+        st->bytes += sizeof(struct apps1);
+        if (walk_terms1(t->app->fun, vs, st, &s1, &d1)) {return -1;}
+        if (walk_terms1(t->app->arg, vs, st, &s2, &d2)) {return -1;}
+        break;
+    }
+    *size = add_sat(1, add_sat(s1, s2));
+    *depth = 1 + max_size(d1, d2);
+    return add_visits(vs, t, *size, *depth);
+}
+
+//  Immediates are not nodes, so they are counted per occurrence. `DEF2`
+//  nodes are leaves: the bound terms belong to the context.
+static int walk_terms2( struct terms2 *t, struct visits *vs
+                      , struct termstats *st, size_t *size, size_t *depth)
+{
+    if (imm_terms2(t)) {
+        if (tag_terms2(t) == VAR2) {
+            st->vars++;
+            st->maxidx = max_size(st->maxidx, idx_terms2(t));
+        } else {
+            st->nums++;
+        }
+        *size = 1;
+        *depth = 1;
+        return 0;
+    }
+    struct marks *m = find_visits(vs, t);
+    if (m) {*size = m->size; *depth = m->depth; return 0;}
+    size_t s1 = 0, s2 = 0, d1 = 0, d2 = 0;
+    st->nodes++;
+    st->bytes += sizeof(struct terms2);
+    switch (t->tag) {
+    case VAR2: // Never a node.
+        break;
+    case NUM2:
+        st->nums++;
+        break;
+    case DEF2:
+        st->defs++;
+        st->bytes += sizeof(struct defs2);
+        break;
+    case LAM2:
+        st->lams++;
+        if (walk_terms2(t->lam, vs, st, &s1, &d1)) {return -1;}
+        break;
+    case APP2:
+        st->apps++;
+        st->bytes += sizeof(struct apps2);
+        if (walk_terms2(t->app->fun, vs, st, &s1, &d1)) {return -1;}
+        if (walk_terms2(t->app->arg, vs, st, &s2, &d2)) {return -1;}
+        break;
+    }
+    *size = add_sat(1, add_sat(s1, s2));
+    *depth = 1 + max_size(d1, d2);
+    return add_visits(vs, t, *size, *depth);
+}
+
+int stats_terms1(struct terms1 *t, struct termstats *st)
+{
+    *st = (struct termstats) {0};
+    struct visits vs = {0};
+    int res = t ? walk_terms1(t, &vs, st, &st->size, &st->depth) : 0;
+    free(vs.els);
+    return res;
+}
+
+int stats_terms2(struct terms2 *t, struct termstats *st)
+{
+    *st = (struct termstats) {0};
+    struct visits vs = {0};
+    int res = t ? walk_terms2(t, &vs, st, &st->size, &st->depth) : 0;
+    free(vs.els);
+    return res;
+}
+
+/* ***** ***** */
+
+void fprintf_termstats(FILE *out, struct termstats st)
+{
+    fprintf( out, "size %zu, nodes %zu, depth %zu, max index %zu, "
+                  "lams %zu, apps %zu, vars %zu, nums %zu, defs %zu, "
+                  "bytes %zu"
+           , st.size, st.nodes, st.depth, st.maxidx
+           , st.lams, st.apps, st.vars, st.nums, st.defs, st.bytes);
+}
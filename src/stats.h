@@ -0,0 +1,59 @@
+/**
+ *          ╔════════════╗
+ *          ║ STATISTICS ║
+ *          ╚════════════╝
+ *
+ * \author  August-Alm@github.com
+ *
+ * \notes   Size statistics of terms, computed in one pass over their
+ *          distinct nodes. Terms share subterms (e.g., every reference
+ *          to a declaration is the same pointer), so a term can be much
+ *          larger as a tree than in memory; both sizes are reported.
+ */
+
+/* ***** ***** */
+
+#ifndef STATS_H
+#define STATS_H
+
+/* ***** ***** */
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "lambda_parser.h"
+
+/* ***** ***** */
+
+/**
+ * \brief   Statistics of a term. The node counts are of distinct nodes,
+ *          variables being counted per occurrence in those.
+ */
+struct termstats {
+    size_t size;    // Nodes of the term as a tree (saturating).
+    size_t nodes;   // Distinct nodes, i.e., as a DAG.
+    size_t depth;   // Maximal number of nodes on a path from the root.
+    size_t maxidx;  // Maximal de Bruijn index (`terms2` only).
+    size_t lams;
+    size_t apps;
+    size_t vars;
+    size_t nums;
+    size_t defs;    // References to declarations (`terms2` only).
+    size_t bytes;   // Estimated heap footprint of the distinct nodes.
+};
+
+/**
+ * \brief   Stores the statistics of `t` in `*st`. Returns `-1`, with
+ *          `*st` incomplete, if memory runs out, `0` otherwise.
+ */
+int stats_terms1(struct terms1 *t, struct termstats *st);
+int stats_terms2(struct terms2 *t, struct termstats *st);
+
+/**
+ * \brief   Prints `st` on one line, without a newline.
+ */
+void fprintf_termstats(FILE *out, struct termstats st);
+
+/* ***** ***** */
+
+#endif // STATS_H